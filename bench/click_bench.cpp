@@ -0,0 +1,140 @@
+// ns per redirect with and without click counting, links hit zipf distributed
+//   cmake -DBUILD_BENCH=ON && make click_bench && ./click_bench [links] [threads] [zipf_s]
+// "atomic" is a shared counter per link bumped on every redirect, what the
+// per-thread buffers of ShortUrlMgr::CountClick are there to avoid
+
+#include "task.h"
+#include "util/LoggerUtil.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace sn;
+
+enum ClickMode {
+    CLICK_MODE_NONE = 0,
+    CLICK_MODE_ATOMIC,
+    CLICK_MODE_BUFFERED,
+};
+
+static const char* ClickModeName(ClickMode mode) {
+    switch (mode) {
+    case CLICK_MODE_NONE: return "none";
+    case CLICK_MODE_ATOMIC: return "atomic";
+    case CLICK_MODE_BUFFERED: return "buffered";
+    }
+    return "";
+}
+
+// link ranks drawn with probability 1 / rank^s, rank 0 the hottest
+static std::vector<std::uint32_t> ZipfRanks(std::size_t links, double s, std::size_t num, std::uint64_t seed) {
+    std::vector<double> cdf(links);
+    double sum = 0;
+    for (std::size_t i = 0; i < links; ++i)
+        cdf[i] = sum += 1.0 / std::pow(i + 1.0, s);
+    std::mt19937_64 rng(seed);
+    std::uniform_real_distribution<double> uniform(0, sum);
+    std::vector<std::uint32_t> ranks(num);
+    for (auto &rank : ranks)
+        rank = std::min<std::size_t>(std::lower_bound(cdf.begin(), cdf.end(), uniform(rng)) - cdf.begin(), links - 1);
+    return ranks;
+}
+
+struct Latency {
+    double ops_per_sec_;
+    double p50_, p99_, p999_;
+};
+
+static Latency RunRedirects(ShortUrlMgr &mgr, const std::vector<HashKey> &keys, int threads, double s, ClickMode mode) {
+    const std::size_t ops = 500000;
+    std::unique_ptr<std::atomic<std::uint64_t>[]> counters(new std::atomic<std::uint64_t>[keys.size()]());
+    std::vector<std::vector<std::uint32_t>> ranks(threads);
+    std::vector<std::vector<std::uint32_t>> samples(threads, std::vector<std::uint32_t>(ops));
+    for (int t = 0; t < threads; ++t)
+        ranks[t] = ZipfRanks(keys.size(), s, ops, t + 1);
+
+    // merges the way main does
+    std::atomic<bool> running(true);
+    std::thread merger([&]() {
+        auto last = std::chrono::steady_clock::now();
+        while (running) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            if (std::chrono::steady_clock::now() - last >= std::chrono::seconds(1)) {
+                last = std::chrono::steady_clock::now();
+                mgr.MergeClicks();
+            }
+        }
+    });
+    std::vector<std::thread> workers;
+    auto start = std::chrono::steady_clock::now();
+    for (int t = 0; t < threads; ++t) {
+        workers.emplace_back([&, t]() {
+            std::size_t sink = 0;
+            for (std::size_t i = 0; i < ops; ++i) {
+                auto rank = ranks[t][i];
+                auto begin = std::chrono::steady_clock::now();
+                auto url = mgr.GetUrl(keys[rank]);
+                sink += url.size();
+                if (mode == CLICK_MODE_ATOMIC)
+                    counters[rank].fetch_add(1, std::memory_order_relaxed);
+                else if (mode == CLICK_MODE_BUFFERED)
+                    mgr.CountClick(keys[rank]);
+                samples[t][i] = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now() - begin).count();
+            }
+            if (sink == 42)
+                std::printf(" ");
+        });
+    }
+    for (auto &worker : workers)
+        worker.join();
+    auto secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    running = false;
+    merger.join();
+    mgr.MergeClicks();
+
+    std::vector<std::uint32_t> all;
+    all.reserve(ops * threads);
+    for (auto &thread_samples : samples)
+        all.insert(all.end(), thread_samples.begin(), thread_samples.end());
+    std::sort(all.begin(), all.end());
+    auto at = [&all](double q) { return static_cast<double>(all[static_cast<std::size_t>(q * (all.size() - 1))]); };
+    return Latency{ all.size() / secs, at(0.5), at(0.99), at(0.999) };
+}
+
+int main(int argc, char **argv) {
+    std::size_t links = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 100000;
+    int threads = argc > 2 ? std::atoi(argv[2]) : static_cast<int>(std::thread::hardware_concurrency());
+    double s = argc > 3 ? std::atof(argv[3]) : 1.1;
+    if (links == 0 || threads <= 0)
+        return 2;
+    LoggerUtil::InitLogRotation(argv[0], "log/", false);
+
+    ShortUrlMgr mgr;
+    mgr.SetHashWidth(8);
+    std::vector<std::string> urls(links);
+    for (std::size_t i = 0; i < links; ++i)
+        urls[i] = "https://example.com/click/" + std::to_string(i);
+    std::vector<HashKey> keys;
+    keys.reserve(links);
+    for (auto &hash : mgr.AddUrls(urls))
+        keys.emplace_back(HashKey::Parse(hash));
+
+    std::printf("%zu links, %d threads, zipf s %.2f\n", links, threads, s);
+    std::printf("%10s %12s %10s %10s %10s\n", "clicks", "redirects/s", "p50_ns", "p99_ns", "p999_ns");
+    for (auto mode : { CLICK_MODE_NONE, CLICK_MODE_ATOMIC, CLICK_MODE_BUFFERED }) {
+        auto lat = RunRedirects(mgr, keys, threads, s, mode);
+        std::printf("%10s %12.0f %10.0f %10.0f %10.0f\n", ClickModeName(mode), lat.ops_per_sec_, lat.p50_, lat.p99_, lat.p999_);
+    }
+    std::printf("hottest link: %llu clicks\n", static_cast<unsigned long long>(mgr.GetUrlInfo(keys[0]).clicks_));
+    return 0;
+}
@@ -0,0 +1,91 @@
+// ns per url of the hashs GenerateHash, AddUrls and the url indexes can use
+//   cmake -DBUILD_BENCH=ON && make hash_bench && ./hash_bench [urls]
+
+#include "url_hash.h"
+#include "util/md5.h"
+#include "util/md5_lanes.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace sn;
+
+static std::vector<std::string> MakeUrls(std::size_t num, std::size_t len) {
+    static const char CHARS[] = "abcdefghijklmnopqrstuvwxyz0123456789/-_.?=&";
+    std::mt19937_64 rng(len);
+    std::vector<std::string> urls(num);
+    for (auto &url : urls) {
+        url = "https://";
+        while (url.size() < len)
+            url += CHARS[rng() % (sizeof(CHARS) - 1)];
+        url.resize(len);
+    }
+    return urls;
+}
+
+// a whole batch through DigestBatch, per url
+static double BatchNsPerUrl(const std::vector<std::string> &urls, md5::LaneIsa isa) {
+    std::vector<std::string_view> inputs(urls.begin(), urls.end());
+    std::unique_ptr<md5::byte[][16]> digests(new md5::byte[urls.size()][16]);
+    md5::DigestBatch(inputs.data(), inputs.size(), digests.get(), isa);
+    auto start = std::chrono::steady_clock::now();
+    const int passes = 5;
+    for (int i = 0; i < passes; ++i)
+        md5::DigestBatch(inputs.data(), inputs.size(), digests.get(), isa);
+    auto ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    return ns / (passes * urls.size());
+}
+
+template <typename Func>
+static double NsPerUrl(const std::vector<std::string> &urls, Func func) {
+    std::uint64_t sink = 0;
+    // one pass to warm the caches
+    for (auto &url : urls)
+        sink += func(url);
+    auto start = std::chrono::steady_clock::now();
+    const int passes = 5;
+    for (int i = 0; i < passes; ++i) {
+        for (auto &url : urls)
+            sink += func(url);
+    }
+    auto ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    if (sink == 42)
+        std::printf(" ");
+    return ns / (passes * urls.size());
+}
+
+int main(int argc, char **argv) {
+    std::size_t num = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 100000;
+    std::printf("md5 lanes: %s\n", md5::LaneIsaName(md5::DetectLaneIsa()));
+    std::printf("%8s %10s %10s %10s %10s %10s %10s\n", "url_len", "md5", "md5_sse2", "md5_avx2", "wyhash128", "wyhash64", "std::hash");
+    for (std::size_t len : { 16, 32, 48, 64, 96, 128, 256, 512, 1024 }) {
+        auto urls = MakeUrls(num, len);
+        // md5 the way GenerateHash does it, the url copied for the retries
+        auto md5_ns = NsPerUrl(urls, [](const std::string &url) {
+            auto tmp_url = url;
+            md5::MD5 hash(tmp_url);
+            return static_cast<std::uint64_t>(hash.digest()[0]);
+        });
+        auto wy128_ns = NsPerUrl(urls, [](const std::string &url) {
+            unsigned char digest[16];
+            WyHash128(url.data(), url.size(), 0, digest);
+            return static_cast<std::uint64_t>(digest[0]);
+        });
+        auto wy64_ns = NsPerUrl(urls, [](const std::string &url) {
+            return static_cast<std::uint64_t>(UrlHasher()(url));
+        });
+        auto std_ns = NsPerUrl(urls, [](const std::string &url) {
+            return static_cast<std::uint64_t>(std::hash<std::string_view>()(url));
+        });
+        auto sse2_ns = BatchNsPerUrl(urls, md5::LANE_ISA_SSE2);
+        auto avx2_ns = BatchNsPerUrl(urls, md5::LANE_ISA_AVX2);
+        std::printf("%8zu %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f\n", len, md5_ns, sse2_ns, avx2_ns, wy128_ns, wy64_ns, std_ns);
+    }
+    return 0;
+}
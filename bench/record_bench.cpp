@@ -0,0 +1,89 @@
+// heap bytes per record of ShortUrlMgr, malloc's in use bytes around the adds
+//   cmake -DBUILD_BENCH=ON && make record_bench && ./record_bench [records] [url_len]
+// then 3 of 4 records are deleted, bytes per record left are shown before and
+// after CompactRecords gives the drained slab pages and url chunks back
+
+#include "rcu.h"
+#include "task.h"
+#include "util/LoggerUtil.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <malloc.h>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace sn;
+
+// lengths spread evenly over [len / 2, len * 3 / 2]
+static std::vector<std::string> MakeUrls(std::size_t num, std::size_t len) {
+    static const char CHARS[] = "abcdefghijklmnopqrstuvwxyz0123456789/-_.?=&";
+    std::mt19937_64 rng(len);
+    std::vector<std::string> urls(num);
+    for (std::size_t i = 0; i < num; ++i) {
+        auto &url = urls[i];
+        url = "https://" + std::to_string(i) + "/";
+        auto size = std::max(url.size(), len / 2 + rng() % (len + 1));
+        while (url.size() < size)
+            url += CHARS[rng() % (sizeof(CHARS) - 1)];
+    }
+    return urls;
+}
+
+// what is retired through rcu counts as freed
+static std::size_t HeapBytes() {
+    Rcu::Synchronize();
+    auto info = ::mallinfo2();
+    return info.uordblks + info.hblkhd;
+}
+
+int main(int argc, char **argv) {
+    std::size_t records = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 1000000;
+    std::size_t url_len = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 64;
+    if (records == 0)
+        return 2;
+    LoggerUtil::InitLogRotation(argv[0], "log/", false);
+
+    auto urls = MakeUrls(records, url_len);
+    std::size_t url_bytes = 0;
+    for (auto &url : urls)
+        url_bytes += url.size();
+    ShortUrlMgr mgr;
+    mgr.SetHashWidth(8);
+    auto base = HeapBytes();
+    auto start = std::chrono::steady_clock::now();
+    // chunked like short_url_import, the hashs handed back are not kept
+    const std::size_t chunk = 65536;
+    for (std::size_t i = 0; i < records; i += chunk) {
+        std::vector<std::string> batch(urls.begin() + i, urls.begin() + std::min(records, i + chunk));
+        mgr.AddUrls(batch);
+    }
+    auto secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    auto added = HeapBytes() - base;
+
+    std::printf("%zu records, avg url %.1f bytes, %zu shards\n", records, double(url_bytes) / records, std::size_t(mgr.GetShardNum()));
+    std::printf("%-24s %14s %14s\n", "", "bytes/record", "overhead/rec");
+    auto report = [&](const char *name, std::size_t bytes, std::size_t count, std::size_t count_url_bytes) {
+        std::printf("%-24s %14.1f %14.1f\n", name, double(bytes) / count, double(bytes - count_url_bytes) / count);
+    };
+    report("added", added, records, url_bytes);
+
+    std::size_t left_url_bytes = 0;
+    for (std::size_t i = 0; i < records; ++i) {
+        if (i % 4 == 0)
+            left_url_bytes += urls[i].size();
+        else
+            mgr.DelUrl(urls[i]);
+    }
+    auto left = mgr.GetRecordCount();
+    report("3 of 4 deleted", HeapBytes() - base, left, left_url_bytes);
+    auto compact_start = std::chrono::steady_clock::now();
+    mgr.CompactRecords();
+    auto compact_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - compact_start).count();
+    report("compacted", HeapBytes() - base, left, left_url_bytes);
+    std::printf("adds %.0f ns/record, compaction %.0f ms\n", secs * 1e9 / records, compact_ms);
+    return 0;
+}
@@ -0,0 +1,107 @@
+#ifndef SN_SHORT_URL_SERVER_ARENA_H
+#define SN_SHORT_URL_SERVER_ARENA_H
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+namespace sn {
+
+// fixed size slots carved from aligned pages, the page header points back to
+// the owner so a slot can be freed from its pointer alone, even by the rcu
+// reclaimer. empty pages are returned, sparse ones can be drained by Compact
+class SlabAllocator {
+public:
+    static constexpr std::size_t PAGE_SIZE = 64 * 1024;
+
+    explicit SlabAllocator(std::size_t slot_size);
+    ~SlabAllocator();
+    SlabAllocator(const SlabAllocator&) = delete;
+    SlabAllocator& operator=(const SlabAllocator&) = delete;
+
+    void* Alloc();
+    static void Free(void *ptr);
+    // stop allocating from pages used below 1/ratio, their slots should be moved
+    void BeginCompact(std::size_t ratio);
+    static bool IsDraining(const void *ptr);
+
+    std::size_t PageCount() const;
+    std::size_t UsedSlots() const;
+
+private:
+    struct Page {
+        SlabAllocator *owner_;
+        Page *prev_;
+        Page *next_;
+        void *free_;
+        std::size_t used_;
+        std::size_t bumped_;
+        std::size_t index_;
+        bool draining_;
+    };
+
+    static Page* PageOf(const void *ptr) {
+        return reinterpret_cast<Page*>(reinterpret_cast<std::uintptr_t>(ptr) & ~(PAGE_SIZE - 1));
+    }
+    void Link(Page *page);
+    void Unlink(Page *page);
+    void FreeInPage(Page *page, void *ptr);
+
+    mutable std::mutex mtx_;
+    std::size_t slot_size_;
+    std::size_t slot_offset_;
+    std::size_t slots_per_page_;
+    // pages having free slots, not draining
+    Page *partial_;
+    std::vector<Page*> pages_;
+    std::size_t used_cnt_;
+};
+
+// variable sized bytes bumped into aligned chunks, a chunk goes back to the
+// system once its last string is released. chunks mostly freed are reported
+// sparse so their strings can be copied out by Compact
+class BumpArena {
+public:
+    static constexpr std::size_t CHUNK_SIZE = 256 * 1024;
+
+    BumpArena();
+    ~BumpArena();
+    BumpArena(const BumpArena&) = delete;
+    BumpArena& operator=(const BumpArena&) = delete;
+
+    char* Alloc(std::size_t size);
+    static void Free(const char *ptr, std::size_t size);
+    // chunks live below 1/ratio of their size become sparse
+    void BeginCompact(std::size_t ratio);
+    static bool IsSparse(const char *ptr);
+
+    std::size_t ReservedBytes() const;
+    std::size_t LiveBytes() const;
+
+private:
+    struct Chunk {
+        BumpArena *owner_;
+        std::size_t size_;
+        std::size_t bumped_;
+        std::size_t live_;
+        std::size_t index_;
+        bool sparse_;
+    };
+
+    static Chunk* ChunkOf(const char *ptr) {
+        return reinterpret_cast<Chunk*>(reinterpret_cast<std::uintptr_t>(ptr) & ~(CHUNK_SIZE - 1));
+    }
+    Chunk* NewChunk(std::size_t size);
+    void ReleaseChunk(Chunk *chunk);
+
+    mutable std::mutex mtx_;
+    Chunk *cur_;
+    std::vector<Chunk*> chunks_;
+    std::size_t reserved_;
+    std::size_t live_;
+};
+
+} /* namespace sn */
+
+#endif // SN_SHORT_URL_SERVER_ARENA_H
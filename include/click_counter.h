@@ -0,0 +1,74 @@
+#ifndef SN_SHORT_URL_SERVER_CLICK_COUNTER_H
+#define SN_SHORT_URL_SERVER_CLICK_COUNTER_H
+
+#include "hash_key.h"
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace sn {
+
+// clicks are appended to a buffer only the clicking thread writes, without
+// locking, so counting writes no cache line another core writes. Drain hands
+// over what the buffers got since the last one, summed per hash, and the
+// visitors of the clicks that had one
+class ClickCounter {
+public:
+    ClickCounter();
+    ~ClickCounter();
+    ClickCounter(const ClickCounter&) = delete;
+    ClickCounter& operator=(const ClickCounter&) = delete;
+
+    // visitor is a hash of who clicked, 0 for none
+    void Count(const HashKey &hash, std::uint64_t visitor = 0);
+    // replaces clicks with the hashs clicked since the last drain and how
+    // often, and visits with each hash and visitor pair, in no order. one
+    // drain at a time
+    void Drain(std::vector<std::pair<HashKey, std::uint64_t>> &clicks,
+        std::vector<std::pair<HashKey, std::uint64_t>> &visits);
+
+private:
+    static constexpr std::size_t BLOCK_CLICKS = 256;
+    // drained blocks a buffer keeps for its owner, fresh ones would fault their pages in on the redirect path
+    static constexpr std::size_t SPARE_BLOCKS = 1024;
+    // size_ only grows, next_ is set once the block is full and the owner is
+    // done with it. a spare block links the next spare through next_
+    struct Click {
+        HashKey hash_;
+        std::uint64_t visitor_;
+    };
+    struct Block {
+        std::atomic<std::size_t> size_{0};
+        std::atomic<Block*> next_{nullptr};
+        Click clicks_[BLOCK_CLICKS];
+    };
+    // the owner appends to tail_ and pops spares_, Drain reads from head_ on
+    // and pushes the blocks behind it to spares_. one popper, so no aba
+    struct Buffer {
+        Buffer() : tail_(new Block()), spares_(nullptr), spare_count_(0), head_(tail_), head_taken_(0) {}
+        ~Buffer();
+        alignas(64) Block *tail_;
+        std::atomic<Block*> spares_;
+        std::atomic<std::size_t> spare_count_;
+        alignas(64) Block *head_;
+        std::size_t head_taken_;
+    };
+    Buffer* LocalBuffer();
+    static Block* NewBlock(Buffer &buffer);
+    static void RecycleBlock(Buffer &buffer, Block *block);
+
+    // tells the counters apart in the thread local cache, addresses get reused
+    const std::uint64_t id_;
+    std::mutex mtx_;
+    // kept when a thread ends, a new thread with its id takes it over
+    std::unordered_map<std::thread::id, std::unique_ptr<Buffer>> buffers_;
+};
+
+} /* namespace sn */
+
+#endif // SN_SHORT_URL_SERVER_CLICK_COUNTER_H
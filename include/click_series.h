@@ -0,0 +1,57 @@
+#ifndef SN_SHORT_URL_SERVER_CLICK_SERIES_H
+#define SN_SHORT_URL_SERVER_CLICK_SERIES_H
+
+#include "hash_key.h"
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace sn {
+
+// clicks of a link per minute over the last day. only the minutes with
+// clicks are kept, as varint pairs of the minutes since the one before and
+// the clicks, so an idle link costs a few bytes and a busy one a few KB at most.
+// the running minute stays open at the end until a later one comes
+class ClickSeries {
+public:
+    static constexpr std::int64_t MINUTES = 24 * 60;
+
+    ClickSeries() : base_minute_(0), tail_minute_(0), last_minute_(0), last_count_(0) {}
+
+    // minute is UnixSeconds / 60, one before the last is added to the last
+    void Add(std::int64_t minute, std::uint64_t count);
+    // drops the minutes before the day up to minute
+    void Trim(std::int64_t minute);
+    bool Empty() const { return last_count_ == 0; }
+    // clicks of each minute of the day up to minute, the oldest first
+    std::vector<std::uint64_t> Counts(std::int64_t minute) const;
+    std::size_t MemoryBytes() const { return data_.capacity(); }
+
+    // varints of the minutes and the open one, then the pairs as they are
+    void Serialize(std::string &out) const;
+    bool Deserialize(std::string_view data);
+
+    // "urls.series" next to the snapshot: a header, then the hash and the
+    // serialized series of each link. written aside and renamed over the old one
+    static bool WriteFile(const std::string &path, const std::vector<std::pair<HashKey, std::string>> &series);
+    // the same without logging, for a forked child. 0 or the errno it failed with
+    static int WriteFileQuiet(const std::string &path, const std::vector<std::pair<HashKey, std::string>> &series);
+    // false if the file is missing or corrupted, series is left empty then
+    static bool ReadFile(const std::string &path, std::vector<std::pair<HashKey, std::string>> &series);
+
+private:
+    static constexpr std::uint32_t FILE_VERSION = 1;
+
+    // the pairs in data_ start at base_minute_ and end at tail_minute_
+    std::string data_;
+    std::int64_t base_minute_;
+    std::int64_t tail_minute_;
+    std::int64_t last_minute_;
+    std::uint64_t last_count_;
+};
+
+} /* namespace sn */
+
+#endif // SN_SHORT_URL_SERVER_CLICK_SERIES_H
@@ -0,0 +1,260 @@
+#ifndef SN_SHORT_URL_SERVER_FLAT_SET_H
+#define SN_SHORT_URL_SERVER_FLAT_SET_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <memory>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace sn {
+
+// open addressing set with swiss table style control bytes, a probe step
+// checks a group of 16 slots at once. growing is incremental: while the old
+// table is migrated both are searched and every modification moves a few
+// slots, so no single call pays for the whole rehash
+template<typename T, typename HASH, typename EQUAL>
+class FlatSet {
+    struct Table;
+
+public:
+    FlatSet() : cur_(new Table(GROUP_SIZE)), migrate_pos_(0), migrate_step_(MIGRATE_STEP) {}
+    FlatSet(const FlatSet&) = delete;
+    FlatSet& operator=(const FlatSet&) = delete;
+
+    // returns the stored element equal to val, or T()
+    T Find(const T &val) const {
+        auto hash = Mix(HASH()(val));
+        auto pos = cur_->Find(val, hash);
+        if (pos != NPOS)
+            return cur_->slots_[pos];
+        if (old_ != nullptr) {
+            pos = old_->Find(val, hash);
+            if (pos != NPOS)
+                return old_->slots_[pos];
+        }
+        return T();
+    }
+    bool Insert(const T &val) {
+        auto hash = Mix(HASH()(val));
+        if (cur_->Find(val, hash) != NPOS || (old_ != nullptr && old_->Find(val, hash) != NPOS))
+            return false;
+        if (cur_->size_ + cur_->tombs_ + 1 > cur_->Capacity() / 8 * 7)
+            Grow();
+        cur_->Put(val, hash);
+        Migrate();
+        return true;
+    }
+    template<typename IT>
+    void Insert(IT first, IT last) {
+        for (; first != last; ++first)
+            Insert(*first);
+    }
+    bool Erase(const T &val) {
+        auto hash = Mix(HASH()(val));
+        auto ret = cur_->Erase(val, hash) || (old_ != nullptr && old_->Erase(val, hash));
+        Migrate();
+        return ret;
+    }
+    // room for n more elements, so bulk inserts never grow on the way
+    void Reserve(std::size_t n) {
+        while (old_ != nullptr)
+            Migrate();
+        auto size = cur_->size_ + n;
+        if (size + cur_->tombs_ <= cur_->Capacity() / 8 * 7)
+            return;
+        std::size_t cap = GROUP_SIZE;
+        while (cap / 8 * 7 < size + GROUP_SIZE)
+            cap <<= 1;
+        old_ = std::move(cur_);
+        cur_.reset(new Table(cap));
+        migrate_pos_ = 0;
+        migrate_step_ = old_->Capacity();
+        Migrate();
+    }
+    void Clear() {
+        cur_.reset(new Table(GROUP_SIZE));
+        old_.reset();
+        migrate_pos_ = 0;
+    }
+    std::size_t Size() const { return cur_->size_ + (old_ != nullptr ? old_->size_ : 0); }
+    bool Empty() const { return Size() == 0; }
+
+    // invalidated by any modification
+    class Iterator {
+    public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef T value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef const T* pointer;
+        typedef const T& reference;
+
+        Iterator(const FlatSet *set, const Table *table) : set_(set), table_(table), pos_(0) { Skip(); }
+        const T& operator*() const { return table_->slots_[pos_]; }
+        Iterator& operator++() {
+            ++pos_;
+            Skip();
+            return *this;
+        }
+        bool operator==(const Iterator &it) const { return table_ == it.table_ && pos_ == it.pos_; }
+        bool operator!=(const Iterator &it) const { return !(*this == it); }
+
+    private:
+        void Skip() {
+            while (table_ != nullptr) {
+                while (pos_ <= table_->mask_ && table_->ctrl_[pos_] < 0)
+                    ++pos_;
+                if (pos_ <= table_->mask_)
+                    return;
+                table_ = table_ == set_->cur_.get() ? set_->old_.get() : nullptr;
+                pos_ = 0;
+            }
+        }
+
+        const FlatSet *set_;
+        const Table *table_;
+        std::size_t pos_;
+    };
+    Iterator begin() const { return Iterator(this, cur_.get()); }
+    Iterator end() const { return Iterator(this, nullptr); }
+
+private:
+    static constexpr std::size_t GROUP_SIZE = 16;
+    static constexpr std::size_t MIGRATE_STEP = 64;
+    static constexpr std::size_t NPOS = ~std::size_t(0);
+    // full slots keep the low 7 hash bits, free ones have the sign bit set
+    static constexpr std::int8_t EMPTY = -128;
+    static constexpr std::int8_t DELETED = -2;
+
+    struct Table {
+        explicit Table(std::size_t cap) : mask_(cap - 1), size_(0), tombs_(0),
+            ctrl_(new std::int8_t[cap]), slots_(new T[cap]()) {
+            std::memset(ctrl_.get(), EMPTY, cap);
+        }
+        std::size_t Capacity() const { return mask_ + 1; }
+
+        std::size_t Find(const T &val, std::size_t hash) const {
+            auto group_mask = mask_ / GROUP_SIZE;
+            auto group = (hash >> 7) & group_mask;
+            for (std::size_t step = 1; ; ++step) {
+                auto ctrl = &ctrl_[group * GROUP_SIZE];
+                for (auto bits = Match(ctrl, H2(hash)); bits != 0; bits &= bits - 1) {
+                    auto pos = group * GROUP_SIZE + __builtin_ctz(bits);
+                    if (EQUAL()(slots_[pos], val))
+                        return pos;
+                }
+                if (Match(ctrl, EMPTY) != 0)
+                    return NPOS;
+                group = (group + step) & group_mask;
+            }
+        }
+        // caller makes sure val is absent
+        void Put(const T &val, std::size_t hash) {
+            auto group_mask = mask_ / GROUP_SIZE;
+            auto group = (hash >> 7) & group_mask;
+            for (std::size_t step = 1; ; ++step) {
+                auto bits = MatchFree(&ctrl_[group * GROUP_SIZE]);
+                if (bits != 0) {
+                    auto pos = group * GROUP_SIZE + __builtin_ctz(bits);
+                    if (ctrl_[pos] == DELETED)
+                        --tombs_;
+                    ctrl_[pos] = H2(hash);
+                    slots_[pos] = val;
+                    ++size_;
+                    return;
+                }
+                group = (group + step) & group_mask;
+            }
+        }
+        bool Erase(const T &val, std::size_t hash) {
+            auto pos = Find(val, hash);
+            if (pos == NPOS)
+                return false;
+            // no probe ever went past a group that still has an empty slot
+            if (Match(&ctrl_[pos & ~(GROUP_SIZE - 1)], EMPTY) != 0)
+                ctrl_[pos] = EMPTY;
+            else {
+                ctrl_[pos] = DELETED;
+                ++tombs_;
+            }
+            slots_[pos] = T();
+            --size_;
+            return true;
+        }
+
+        std::size_t mask_;
+        std::size_t size_;
+        std::size_t tombs_;
+        std::unique_ptr<std::int8_t[]> ctrl_;
+        std::unique_ptr<T[]> slots_;
+    };
+
+    static std::size_t Mix(std::size_t hash) {
+        std::uint64_t h = hash * 0x9E3779B97F4A7C15ull;
+        return static_cast<std::size_t>(h ^ (h >> 32));
+    }
+    static std::int8_t H2(std::size_t hash) { return static_cast<std::int8_t>(hash & 0x7F); }
+
+    static std::uint32_t Match(const std::int8_t *ctrl, std::int8_t h2) {
+#ifdef __SSE2__
+        auto group = _mm_loadu_si128(reinterpret_cast<const __m128i*>(ctrl));
+        return static_cast<std::uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8(h2))));
+#else
+        std::uint32_t bits = 0;
+        for (std::size_t i = 0; i < GROUP_SIZE; ++i)
+            bits |= static_cast<std::uint32_t>(ctrl[i] == h2) << i;
+        return bits;
+#endif
+    }
+    static std::uint32_t MatchFree(const std::int8_t *ctrl) {
+#ifdef __SSE2__
+        return static_cast<std::uint32_t>(_mm_movemask_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(ctrl))));
+#else
+        std::uint32_t bits = 0;
+        for (std::size_t i = 0; i < GROUP_SIZE; ++i)
+            bits |= static_cast<std::uint32_t>(ctrl[i] < 0) << i;
+        return bits;
+#endif
+    }
+
+    void Grow() {
+        while (old_ != nullptr)
+            Migrate();
+        auto size = cur_->size_;
+        std::size_t cap = GROUP_SIZE;
+        while (cap / 8 * 7 < size * 2 + GROUP_SIZE)
+            cap <<= 1;
+        old_ = std::move(cur_);
+        cur_.reset(new Table(cap));
+        migrate_pos_ = 0;
+        // finish before the inserts in between can fill the new table
+        migrate_step_ = std::max(MIGRATE_STEP, old_->Capacity() / (size + GROUP_SIZE) + 1);
+    }
+    void Migrate() {
+        if (old_ == nullptr)
+            return;
+        auto end = std::min(migrate_pos_ + migrate_step_, old_->Capacity());
+        for (; migrate_pos_ < end; ++migrate_pos_) {
+            if (old_->ctrl_[migrate_pos_] < 0)
+                continue;
+            auto &val = old_->slots_[migrate_pos_];
+            cur_->Put(val, Mix(HASH()(val)));
+            old_->ctrl_[migrate_pos_] = DELETED;
+            --old_->size_;
+        }
+        if (migrate_pos_ >= old_->Capacity())
+            old_.reset();
+    }
+
+    std::unique_ptr<Table> cur_;
+    std::unique_ptr<Table> old_;
+    std::size_t migrate_pos_;
+    std::size_t migrate_step_;
+};
+
+} /* namespace sn */
+
+#endif // SN_SHORT_URL_SERVER_FLAT_SET_H
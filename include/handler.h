@@ -7,9 +7,15 @@
 namespace sn {
 
 DECLARE_REQUEST_HANDLER(HdlShortUrlAdd, sn::ServerConfig);
+DECLARE_REQUEST_HANDLER(HdlShortUrlAddBatch, sn::ServerConfig);
 DECLARE_REQUEST_HANDLER(HdlShortUrlDel, sn::ServerConfig);
 DECLARE_REQUEST_HANDLER(HdlShortUrlGet, sn::ServerConfig);
+DECLARE_REQUEST_HANDLER(HdlShortUrlGetBatch, sn::ServerConfig);
+DECLARE_REQUEST_HANDLER(HdlShortUrlExport, sn::ServerConfig);
 DECLARE_REQUEST_HANDLER(HdlShortUrlJump, sn::ServerConfig);
+DECLARE_REQUEST_HANDLER(HdlShortUrlVisitors, sn::ServerConfig);
+DECLARE_REQUEST_HANDLER(HdlShortUrlTop, sn::ServerConfig);
+DECLARE_REQUEST_HANDLER(HdlShortUrlSeries, sn::ServerConfig);
 DECLARE_REQUEST_HANDLER(HdlShortUrlWebpage, sn::ServerConfig);
 DECLARE_REQUEST_HANDLER(HdlShortUrlCfgGet, sn::ServerConfig);
 DECLARE_REQUEST_HANDLER(HdlShortUrlStatic, sn::ServerConfig);
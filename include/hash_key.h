@@ -0,0 +1,82 @@
+#ifndef SN_SHORT_URL_SERVER_HASH_KEY_H
+#define SN_SHORT_URL_SERVER_HASH_KEY_H
+
+#include <cstdint>
+#include <string>
+
+namespace sn {
+
+enum KeyAlphabet {
+    KEY_ALPHABET_HEX = 0,       // 0-9a-f
+    KEY_ALPHABET_BASE62,        // 0-9A-Za-z
+    KEY_ALPHABET_BASE58,        // base62 without 0 O I l
+};
+
+extern bool ParseKeyAlphabet(const std::string &name, KeyAlphabet &alphabet);
+extern const char* KeyAlphabetName(KeyAlphabet alphabet);
+
+// short url key: the digits as a 128 bits integer, so hex keys take all 32
+// digits of a md5, with the width and the alphabet aside, so "0a1" and "a1"
+// stay different. a string of lowercase hex digits only is always a hex key,
+// keys of other alphabets never spell like that
+struct HashKey {
+    static const int MAX_WIDTH = 32;
+
+    std::uint64_t lo_;
+    std::uint64_t hi_;
+    std::uint8_t width_;
+    std::uint8_t alphabet_;
+
+    HashKey() : lo_(0), hi_(0), width_(0), alphabet_(KEY_ALPHABET_HEX) {}
+    HashKey(unsigned __int128 val, int width, KeyAlphabet alphabet = KEY_ALPHABET_HEX) : lo_(static_cast<std::uint64_t>(val)),
+        hi_(static_cast<std::uint64_t>(val >> 64)), width_(static_cast<std::uint8_t>(width)),
+        alphabet_(static_cast<std::uint8_t>(alphabet)) {}
+
+    int Width() const { return width_; }
+    KeyAlphabet Alphabet() const { return static_cast<KeyAlphabet>(alphabet_); }
+    unsigned __int128 Value() const { return (static_cast<unsigned __int128>(hi_) << 64) | lo_; }
+    bool Empty() const { return width_ == 0; }
+    std::string ToString() const;
+    // a non hex key spelled with hex digits only, it could not be parsed back
+    bool IsSpelledHex() const;
+
+    bool operator==(const HashKey &key) const {
+        return lo_ == key.lo_ && hi_ == key.hi_ && width_ == key.width_ && alphabet_ == key.alphabet_;
+    }
+    bool operator!=(const HashKey &key) const { return !(*this == key); }
+    // by alphabet, width then digits
+    bool operator<(const HashKey &key) const {
+        if (alphabet_ != key.alphabet_)
+            return alphabet_ < key.alphabet_;
+        if (width_ != key.width_)
+            return width_ < key.width_;
+        return hi_ != key.hi_ ? hi_ < key.hi_ : lo_ < key.lo_;
+    }
+
+    // 1 ~ MaxWidth chars of alphabet, or lowercase hex of 1 ~ MAX_WIDTH chars whatever alphabet is
+    static bool TryParse(const std::string &str, HashKey &key, KeyAlphabet alphabet = KEY_ALPHABET_HEX);
+    static HashKey Parse(const std::string &str, KeyAlphabet alphabet = KEY_ALPHABET_HEX);
+    // width digits from the leading bits of a 16 bytes digest, hex keys are its hex string prefix
+    static HashKey FromDigest(const unsigned char *digest, int width, KeyAlphabet alphabet = KEY_ALPHABET_HEX);
+
+    static int Radix(KeyAlphabet alphabet);
+    // the widest key of the alphabet, MAX_WIDTH for hex
+    static int MaxWidth(KeyAlphabet alphabet);
+    // radix^width, the number of keys of a width. 2^128 - 1 for 32 hex digits
+    static unsigned __int128 Space(KeyAlphabet alphabet, int width);
+};
+
+struct HashKeyHasher {
+    std::size_t operator()(const HashKey &key) const {
+        auto meta = key.width_ | (static_cast<std::uint64_t>(key.alphabet_) << 8);
+        std::uint64_t h = key.lo_ ^ ((key.hi_ ^ meta) * 0x9E3779B97F4A7C15ull);
+        h ^= h >> 32;
+        h *= 0xD6E8FEB86659FD93ull;
+        h ^= h >> 32;
+        return static_cast<std::size_t>(h);
+    }
+};
+
+} /* namespace sn */
+
+#endif // SN_SHORT_URL_SERVER_HASH_KEY_H
@@ -0,0 +1,89 @@
+#ifndef SN_SHORT_URL_SERVER_HOT_LINKS_H
+#define SN_SHORT_URL_SERVER_HOT_LINKS_H
+
+#include "hash_key.h"
+#include <algorithm>
+#include <cstdint>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace sn {
+
+// the links with the most clicks over the last hour, in buckets of 10
+// seconds. the clicks of the running bucket go through a count-min sketch
+// and a space-saving summary of the links with the biggest estimates, a link
+// enters the summary at its sketch estimate instead of at the minimum, so
+// the long tail does not churn it. a closed bucket keeps its summary only,
+// a window sums the summaries of its buckets. not thread safe
+class HotLinks {
+public:
+    static constexpr std::int64_t BUCKET_SEC = 10;
+    static constexpr std::size_t BUCKETS = 360;
+    // links a bucket keeps, Top is exact enough for a fraction of that
+    static constexpr std::size_t CAPACITY = 256;
+
+    struct Entry {
+        HashKey hash_;
+        // off by error_ at most
+        std::uint64_t count_;
+        std::uint64_t error_;
+    };
+
+    explicit HotLinks(std::int64_t now);
+
+    // clicks summed per hash at now, UnixSeconds
+    void Add(std::int64_t now, const std::vector<std::pair<HashKey, std::uint64_t>> &clicks);
+    // the k links with the most clicks in the window_sec up to now, the most first.
+    // the window is rounded up to whole buckets, the running one included
+    std::vector<Entry> Top(std::int64_t now, std::int64_t window_sec, std::size_t k) const;
+
+private:
+    static constexpr int SKETCH_DEPTH = 4;
+    static constexpr std::size_t SKETCH_WIDTH = 2048;
+
+    // count-min sketch with conservative update, a row only grows to the new minimum
+    class Sketch {
+    public:
+        Sketch() : counts_(SKETCH_DEPTH * SKETCH_WIDTH, 0) {}
+        // the estimate of hash after adding count
+        std::uint64_t Add(const HashKey &hash, std::uint64_t count);
+        void Clear() { std::fill(counts_.begin(), counts_.end(), 0); }
+
+    private:
+        std::vector<std::uint64_t> counts_;
+    };
+    // space-saving summary, a min heap by count with the heap position of each hash
+    class Summary {
+    public:
+        // estimate is what the sketch has of hash with count in
+        void Add(const HashKey &hash, std::uint64_t count, std::uint64_t estimate);
+        bool IsFull() const { return heap_.size() >= CAPACITY; }
+        std::uint64_t MinCount() const { return heap_.empty() ? 0 : heap_.front().count_; }
+        const std::vector<Entry>& Entries() const { return heap_; }
+        void Clear() { heap_.clear(); pos_.clear(); }
+
+    private:
+        void SiftDown(std::size_t i);
+        void Swap(std::size_t i, std::size_t j);
+
+        std::vector<Entry> heap_;
+        std::unordered_map<HashKey, std::size_t, HashKeyHasher> pos_;
+    };
+    struct Bucket {
+        // the bucket number, a slot of an older number is stale
+        std::int64_t number_ = -1;
+        bool full_ = false;
+        std::uint64_t min_count_ = 0;
+        std::vector<Entry> entries_;
+    };
+
+    std::int64_t current_;
+    Sketch sketch_;
+    Summary live_;
+    std::vector<Bucket> buckets_;
+};
+
+} /* namespace sn */
+
+#endif // SN_SHORT_URL_SERVER_HOT_LINKS_H
@@ -0,0 +1,54 @@
+#ifndef SN_SHORT_URL_SERVER_HYPERLOGLOG_H
+#define SN_SHORT_URL_SERVER_HYPERLOGLOG_H
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace sn {
+
+// distinct count estimate of 64 bits hashs over 2^11 registers, about 2.3%
+// standard error. starts sparse, a sorted list of the registers set, and
+// turns into the 6 bits packed registers, 1.5 KB, once the list would be
+// half that size
+class HyperLogLog {
+public:
+    static constexpr int PRECISION = 11;
+    static constexpr std::size_t REGISTERS = std::size_t(1) << PRECISION;
+    static constexpr std::size_t DENSE_BYTES = REGISTERS * 6 / 8;
+    // a register holds the leading zeros of the hash bits past the index plus one
+    static constexpr int MAX_RANK = 64 - PRECISION + 1;
+
+    void Add(std::uint64_t hash);
+    // the union of both counted sets
+    void Merge(const HyperLogLog &other);
+    std::uint64_t Estimate() const;
+    bool IsSparse() const { return dense_.empty(); }
+    std::size_t MemoryBytes() const { return sparse_.capacity() * sizeof(std::uint32_t) + dense_.capacity(); }
+
+    // a format byte then the sparse entries or the packed registers
+    void Serialize(std::string &out) const;
+    bool Deserialize(std::string_view data);
+
+private:
+    static constexpr std::size_t SPARSE_MAX = DENSE_BYTES / 2 / sizeof(std::uint32_t);
+    enum Format : std::uint8_t {
+        FORMAT_SPARSE = 0,
+        FORMAT_DENSE = 1,
+    };
+
+    int Get(std::size_t index) const;
+    void Set(std::size_t index, int rank);
+    // keeps the bigger rank of the register
+    void Update(std::size_t index, int rank);
+    void ToDense();
+
+    // index << 8 | rank, sorted by index, one entry per register
+    std::vector<std::uint32_t> sparse_;
+    std::vector<std::uint8_t> dense_;
+};
+
+} /* namespace sn */
+
+#endif // SN_SHORT_URL_SERVER_HYPERLOGLOG_H
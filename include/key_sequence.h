@@ -0,0 +1,51 @@
+#ifndef SN_SHORT_URL_SERVER_KEY_SEQUENCE_H
+#define SN_SHORT_URL_SERVER_KEY_SEQUENCE_H
+
+#include "hash_key.h"
+#include <cstdint>
+#include <string>
+
+namespace sn {
+
+enum HashMode {
+    HASH_MODE_MD5 = 0,          // leading digits of the url md5, retried on collision
+    HASH_MODE_SEQUENCE,         // a counter through KeyPermutation, no collision among its keys
+};
+
+extern bool ParseHashMode(const std::string &name, HashMode &mode);
+
+// keyed feistel network over the keys of one width and alphabet: numbers
+// below Space map to keys that look random, two numbers never share a key
+class KeyPermutation {
+public:
+    explicit KeyPermutation(const std::string &secret);
+
+    // counters are 56 bits, the widest hex space that fits has 14 chars
+    static bool Fits(int width, KeyAlphabet alphabet) { return HashKey::Space(alphabet, width) <= (std::uint64_t(1) << 56); }
+    static std::uint64_t Space(int width, KeyAlphabet alphabet) { return static_cast<std::uint64_t>(HashKey::Space(alphabet, width)); }
+
+    // num < Space, the width and alphabet Fits
+    HashKey Permute(std::uint64_t num, int width, KeyAlphabet alphabet) const;
+
+    // a counter with the width and alphabet it counts in, the width in the low
+    // 5 bits of the top byte and the alphabet in its high 3 bits, the way logs
+    // and snapshots keep it
+    static std::uint64_t Pack(int width, KeyAlphabet alphabet, std::uint64_t num) {
+        return (std::uint64_t(width) << 56) | (std::uint64_t(alphabet) << 61) | num;
+    }
+    static int PackedWidth(std::uint64_t packed) { return static_cast<int>((packed >> 56) & 0x1F); }
+    static KeyAlphabet PackedAlphabet(std::uint64_t packed) { return static_cast<KeyAlphabet>(packed >> 61); }
+    static std::uint64_t PackedNum(std::uint64_t packed) { return packed & ((std::uint64_t(1) << 56) - 1); }
+
+private:
+    static const int ROUNDS = 4;
+
+    // a balanced network over 2 * half bits
+    std::uint64_t Feistel(std::uint64_t num, int half) const;
+
+    std::uint64_t keys_[ROUNDS];
+};
+
+} /* namespace sn */
+
+#endif // SN_SHORT_URL_SERVER_KEY_SEQUENCE_H
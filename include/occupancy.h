@@ -0,0 +1,61 @@
+#ifndef SN_SHORT_URL_SERVER_OCCUPANCY_H
+#define SN_SHORT_URL_SERVER_OCCUPANCY_H
+
+#include "hash_key.h"
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+namespace sn {
+
+// which hashs of one width and alphabet are taken, read without any shard
+// lock. up to DENSE_MAX_SPACE keys every key owns a bit and answers are exact,
+// larger spaces go to a blocked bloom filter touching one cache line per key.
+// bloom bits are never cleared, so a set answer there still has to be checked
+// on the records
+class HashOccupancy {
+public:
+    // 2MB of bits, 6 hex or 4 base62 chars
+    static constexpr std::uint64_t DENSE_MAX_SPACE = std::uint64_t(1) << 24;
+
+    // expect sizes the bloom filter, it keeps working past it with more false positives
+    HashOccupancy(int width, KeyAlphabet alphabet, std::size_t expect);
+    HashOccupancy(const HashOccupancy&) = delete;
+    HashOccupancy& operator=(const HashOccupancy&) = delete;
+
+    int Width() const { return width_; }
+    KeyAlphabet Alphabet() const { return alphabet_; }
+    bool IsExact() const { return exact_; }
+    bool IsTracked(const HashKey &key) const { return key.Width() == width_ && key.Alphabet() == alphabet_; }
+    // untracked keys are ignored
+    bool MayContain(const HashKey &key) const;
+    void Add(const HashKey &key);
+    void Remove(const HashKey &key);
+
+    std::size_t Count() const { return count_.load(std::memory_order_relaxed); }
+    // keys whose bits are set, removed bloom keys keep theirs until a rebuild
+    std::size_t Filled() const { return Count() + removed_.load(std::memory_order_relaxed); }
+    std::size_t Expect() const { return expect_; }
+    std::size_t Bytes() const { return block_num_ * sizeof(Block); }
+    // taken keys of the whole key space of the width
+    double Ratio() const;
+
+private:
+    // one cache line, a bloom key sets one bit in each word
+    struct alignas(64) Block {
+        std::atomic<std::uint64_t> words_[8];
+    };
+
+    int width_;
+    KeyAlphabet alphabet_;
+    bool exact_;
+    std::size_t expect_;
+    std::size_t block_num_;
+    std::unique_ptr<Block[]> blocks_;
+    std::atomic<std::size_t> count_;
+    std::atomic<std::size_t> removed_;
+};
+
+} /* namespace sn */
+
+#endif // SN_SHORT_URL_SERVER_OCCUPANCY_H
@@ -12,6 +12,7 @@ enum ServerErrorCode {
 
     INTERNAL_UNKNOWN_ERROR      = 501,      // 未知错误
     INTERNAL_REQUEST_ERROR,                 // 网络问题，请求错误
+    INTERNAL_STORAGE_ERROR,                 // 写日志失败，改动未落盘
 
     REQ_JSON_ERROR              = 1001,     // 请求 json 格式错误
     REQ_PARAMS_ERROR,                       // 请求 json 中参数错误
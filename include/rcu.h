@@ -0,0 +1,272 @@
+#ifndef SN_SHORT_URL_SERVER_RCU_H
+#define SN_SHORT_URL_SERVER_RCU_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <functional>
+
+namespace sn {
+namespace Rcu {
+
+// epoch based reclamation, readers only write their own per-thread slot,
+// retired pointers are freed after every reader left the retire epoch
+extern void ReadLock();
+extern void ReadUnlock();
+extern void Retire(void *ptr, void (*deleter)(void*));
+extern void Reclaim();
+// waits for readers older than the call and frees what was retired before it,
+// must not be called inside a read section
+extern void Synchronize();
+extern std::size_t PendingCount();
+
+template<typename T>
+void RetireDelete(T *ptr) {
+    Retire(ptr, [](void *p) { delete static_cast<T*>(p); });
+}
+
+struct ReadGuard {
+    ReadGuard() { ReadLock(); }
+    ~ReadGuard() { ReadUnlock(); }
+    ReadGuard(const ReadGuard&) = delete;
+    ReadGuard& operator=(const ReadGuard&) = delete;
+};
+
+} /* namespace Rcu */
+
+// open addressing index with lock-free Find over records owned by the caller,
+// writers must be serialized outside and readers must hold Rcu::ReadGuard.
+// slots keep the record pointer tagged with 16 hash bits in the unused top
+// bits, growing copies a few slots per write while readers see both tables
+template<typename REC, typename KEY, KEY REC::*KEY_MEMBER, typename HASHER = std::hash<KEY>>
+class RcuHashIndex {
+    static_assert(sizeof(void*) == 8, "tagged slots need 64 bits pointers");
+
+public:
+    RcuHashIndex() : size_(0), migrate_pos_(0), migrate_step_(MIGRATE_STEP),
+        tables_(new Tables{ new Table(MIN_CAPACITY), nullptr }) {}
+    ~RcuHashIndex() {
+        auto tables = tables_.load();
+        delete tables->cur_;
+        delete tables->old_;
+        delete tables;
+    }
+    RcuHashIndex(const RcuHashIndex&) = delete;
+    RcuHashIndex& operator=(const RcuHashIndex&) = delete;
+
+    const REC* Find(const KEY &key) const {
+        auto tables = tables_.load(std::memory_order_acquire);
+        auto hash = Mix(HASHER()(key));
+        auto rec = tables->cur_->Find(key, hash);
+        if (rec == nullptr && tables->old_ != nullptr)
+            rec = tables->old_->Find(key, hash);
+        return rec;
+    }
+    // the two halves of a Find ahead of time, for callers with many keys: the
+    // home slot first, then the record its tag points at once the slot is cached
+    void PrefetchSlot(const KEY &key) const {
+        auto tables = tables_.load(std::memory_order_acquire);
+        auto hash = Mix(HASHER()(key));
+        tables->cur_->PrefetchSlot(hash);
+        if (tables->old_ != nullptr)
+            tables->old_->PrefetchSlot(hash);
+    }
+    void PrefetchRecord(const KEY &key) const {
+        auto tables = tables_.load(std::memory_order_acquire);
+        tables->cur_->PrefetchRecord(Mix(HASHER()(key)));
+    }
+    // replace the record if key exists, in its slot so readers never miss the key
+    void Insert(REC *rec) {
+        auto hash = Mix(HASHER()(rec->*KEY_MEMBER));
+        auto tables = tables_.load(std::memory_order_relaxed);
+        // a migrated key is in both tables, an unmigrated one only in the old
+        auto replaced = tables->cur_->Replace(rec, hash);
+        if (tables->old_ != nullptr)
+            replaced = tables->old_->Replace(rec, hash) || replaced;
+        if (!replaced) {
+            auto cur = tables->cur_;
+            if (cur->used_ + 1 > cur->Capacity() / 4 * 3) {
+                Grow();
+                cur = tables_.load(std::memory_order_relaxed)->cur_;
+            }
+            cur->Put(rec, hash);
+            ++size_;
+        }
+        Migrate();
+    }
+    bool Erase(const KEY &key) {
+        auto tables = tables_.load(std::memory_order_relaxed);
+        auto hash = Mix(HASHER()(key));
+        // migrated records stay in the old table until it is dropped
+        auto erased = tables->cur_->Erase(key, hash);
+        if (tables->old_ != nullptr)
+            erased = tables->old_->Erase(key, hash) || erased;
+        if (erased)
+            --size_;
+        Migrate();
+        return erased;
+    }
+    // room for n more records, migrated at once instead of along the inserts
+    void Reserve(std::size_t n) {
+        while (tables_.load(std::memory_order_relaxed)->old_ != nullptr)
+            Migrate();
+        auto cur = tables_.load(std::memory_order_relaxed)->cur_;
+        if (cur->used_ + n <= cur->Capacity() / 4 * 3)
+            return;
+        std::size_t cap = MIN_CAPACITY;
+        while (cap / 4 * 3 < size_ + n + MIN_CAPACITY)
+            cap <<= 1;
+        Publish(new Table(cap), cur);
+        migrate_pos_ = 0;
+        migrate_step_ = cur->Capacity();
+        Migrate();
+    }
+    void Clear() {
+        auto old_tables = tables_.exchange(new Tables{ new Table(MIN_CAPACITY), nullptr }, std::memory_order_acq_rel);
+        Rcu::RetireDelete(old_tables->cur_);
+        if (old_tables->old_ != nullptr)
+            Rcu::RetireDelete(old_tables->old_);
+        Rcu::RetireDelete(old_tables);
+        size_ = 0;
+        migrate_pos_ = 0;
+    }
+    std::size_t Size() const { return size_; }
+
+private:
+    static constexpr std::size_t MIN_CAPACITY = 16;
+    static constexpr std::size_t MIGRATE_STEP = 64;
+    static constexpr std::uintptr_t EMPTY = 0;
+    static constexpr std::uintptr_t DELETED = 1;
+    static constexpr std::uintptr_t PTR_MASK = (std::uintptr_t(1) << 48) - 1;
+
+    struct Table {
+        explicit Table(std::size_t cap) : bits_(0), mask_(cap - 1), used_(0),
+            slots_(new std::atomic<std::uintptr_t>[cap]) {
+            while ((std::size_t(1) << bits_) < cap)
+                ++bits_;
+            for (std::size_t i = 0; i < cap; ++i)
+                slots_[i].store(EMPTY, std::memory_order_relaxed);
+        }
+        std::size_t Capacity() const { return mask_ + 1; }
+        // fibonacci hashing takes the high bits, shards are selected by the low ones
+        std::size_t Index(std::uint64_t hash) const { return bits_ == 0 ? 0 : hash >> (64 - bits_); }
+        static std::uintptr_t Tag(std::uint64_t hash) { return static_cast<std::uintptr_t>((hash >> 16) & 0xFFFF) << 48; }
+
+        const REC* Find(const KEY &key, std::uint64_t hash) const {
+            auto tag = Tag(hash);
+            for (auto pos = Index(hash); ; pos = (pos + 1) & mask_) {
+                auto slot = slots_[pos].load(std::memory_order_acquire);
+                if (slot == EMPTY)
+                    return nullptr;
+                if (slot != DELETED && (slot & ~PTR_MASK) == tag) {
+                    auto rec = reinterpret_cast<const REC*>(slot & PTR_MASK);
+                    if (rec->*KEY_MEMBER == key)
+                        return rec;
+                }
+            }
+        }
+        void PrefetchSlot(std::uint64_t hash) const { __builtin_prefetch(&slots_[Index(hash)]); }
+        void PrefetchRecord(std::uint64_t hash) const {
+            auto slot = slots_[Index(hash)].load(std::memory_order_acquire);
+            if (slot != EMPTY && slot != DELETED && (slot & ~PTR_MASK) == Tag(hash))
+                __builtin_prefetch(reinterpret_cast<const void*>(slot & PTR_MASK));
+        }
+        // slots never go back to empty, so a reader probing past one stays right
+        void Put(REC *rec, std::uint64_t hash) {
+            for (auto pos = Index(hash); ; pos = (pos + 1) & mask_) {
+                auto slot = slots_[pos].load(std::memory_order_relaxed);
+                if (slot == EMPTY || slot == DELETED) {
+                    if (slot == EMPTY)
+                        ++used_;
+                    slots_[pos].store(reinterpret_cast<std::uintptr_t>(rec) | Tag(hash), std::memory_order_release);
+                    return;
+                }
+            }
+        }
+        // the slot of the key gets rec, false if the key is not there
+        bool Replace(REC *rec, std::uint64_t hash) {
+            auto tag = Tag(hash);
+            for (auto pos = Index(hash); ; pos = (pos + 1) & mask_) {
+                auto slot = slots_[pos].load(std::memory_order_relaxed);
+                if (slot == EMPTY)
+                    return false;
+                if (slot != DELETED && (slot & ~PTR_MASK) == tag &&
+                        reinterpret_cast<const REC*>(slot & PTR_MASK)->*KEY_MEMBER == rec->*KEY_MEMBER) {
+                    slots_[pos].store(reinterpret_cast<std::uintptr_t>(rec) | tag, std::memory_order_release);
+                    return true;
+                }
+            }
+        }
+        bool Erase(const KEY &key, std::uint64_t hash) {
+            auto tag = Tag(hash);
+            for (auto pos = Index(hash); ; pos = (pos + 1) & mask_) {
+                auto slot = slots_[pos].load(std::memory_order_relaxed);
+                if (slot == EMPTY)
+                    return false;
+                if (slot != DELETED && (slot & ~PTR_MASK) == tag &&
+                        reinterpret_cast<const REC*>(slot & PTR_MASK)->*KEY_MEMBER == key) {
+                    slots_[pos].store(DELETED, std::memory_order_release);
+                    return true;
+                }
+            }
+        }
+
+        std::size_t bits_;
+        std::size_t mask_;
+        // full and deleted slots
+        std::size_t used_;
+        std::unique_ptr<std::atomic<std::uintptr_t>[]> slots_;
+    };
+    // readers load both tables at once, replaced as a whole
+    struct Tables {
+        Table *cur_;
+        Table *old_;
+    };
+
+    static std::uint64_t Mix(std::size_t hash) { return hash * 0x9E3779B97F4A7C15ull; }
+
+    void Publish(Table *cur, Table *old) {
+        auto old_tables = tables_.exchange(new Tables{ cur, old }, std::memory_order_acq_rel);
+        Rcu::RetireDelete(old_tables);
+    }
+    void Grow() {
+        while (tables_.load(std::memory_order_relaxed)->old_ != nullptr)
+            Migrate();
+        std::size_t cap = MIN_CAPACITY;
+        while (cap / 4 * 3 < size_ * 2 + MIN_CAPACITY)
+            cap <<= 1;
+        auto old = tables_.load(std::memory_order_relaxed)->cur_;
+        Publish(new Table(cap), old);
+        migrate_pos_ = 0;
+        // finish before the inserts in between can fill the new table
+        migrate_step_ = std::max(MIGRATE_STEP, old->Capacity() / (size_ + MIN_CAPACITY) + 1);
+    }
+    void Migrate() {
+        auto tables = tables_.load(std::memory_order_relaxed);
+        auto old = tables->old_;
+        if (old == nullptr)
+            return;
+        auto end = std::min(migrate_pos_ + migrate_step_, old->Capacity());
+        for (; migrate_pos_ < end; ++migrate_pos_) {
+            auto slot = old->slots_[migrate_pos_].load(std::memory_order_relaxed);
+            if (slot == EMPTY || slot == DELETED)
+                continue;
+            auto rec = reinterpret_cast<REC*>(slot & PTR_MASK);
+            tables->cur_->Put(rec, Mix(HASHER()(rec->*KEY_MEMBER)));
+        }
+        if (migrate_pos_ >= old->Capacity()) {
+            Publish(tables->cur_, nullptr);
+            Rcu::RetireDelete(old);
+        }
+    }
+
+    std::size_t size_;
+    std::size_t migrate_pos_;
+    std::size_t migrate_step_;
+    std::atomic<Tables*> tables_;
+};
+
+} /* namespace sn */
+
+#endif // SN_SHORT_URL_SERVER_RCU_H
@@ -107,7 +107,8 @@ private:
 public:
     virtual Poco::Net::HTTPRequestHandler* createRequestHandler(const Poco::Net::HTTPServerRequest &req) override {
         auto &method = req.getMethod();
-        auto &uri = req.getURI();
+        // routed by the path, handlers read the query themselves
+        auto uri = req.getURI().substr(0, req.getURI().find('?'));
         RequestContext ctx;
         // LoggerUtil::LogInfo() << "proc req method:" << method << " uri:" << uri << "\n  - client:" << req.clientAddress().toString() <<
         //         " server:" << req.serverAddress().toString();
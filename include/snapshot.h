@@ -0,0 +1,90 @@
+#ifndef SN_SHORT_URL_SERVER_SNAPSHOT_H
+#define SN_SHORT_URL_SERVER_SNAPSHOT_H
+
+#include "hash_key.h"
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace sn {
+
+struct SnapshotRecord {
+    HashKey hash_;
+    std::int64_t expire_at_;
+    std::string_view url_;
+    std::uint64_t clicks_;
+    // HyperLogLog::Serialize of the visitors, empty if none were counted
+    std::string_view visitors_;
+};
+
+// binary snapshot "urls.snap": a header, the index of fixed width entries
+// sorted by hash, then the blob of the urls each followed by its visitor
+// sketch, the entries point into it. the checksum
+// covers everything after the header. the file is mapped read only and
+// lookups binary search the index in place, nothing is built to serve it.
+// Open only checks the header and the layout, the rest is left to Verify so
+// the server answers from the file while it reads it through
+class SnapshotFile {
+public:
+    static constexpr std::uint32_t VERSION = 1;
+
+    ~SnapshotFile();
+    SnapshotFile(const SnapshotFile&) = delete;
+    SnapshotFile& operator=(const SnapshotFile&) = delete;
+
+    // nullptr if the file can not be mapped, has another version or a bad layout
+    static std::unique_ptr<SnapshotFile> Open(const std::string &path);
+    // sorts records by hash and writes them to path, synced when it returns true.
+    // sequence is kept in the header, files of older writers have 0
+    static bool Write(const std::string &path, std::vector<SnapshotRecord> &records, std::uint64_t sequence = 0);
+    // the same without logging, for a forked child. 0 or the errno it failed with
+    static int WriteQuiet(const std::string &path, std::vector<SnapshotRecord> &records, std::uint64_t sequence = 0);
+    // fills rec with the record i in hash order, its views stay valid until the next call
+    typedef std::function<void(std::size_t i, SnapshotRecord &rec)> RecordAt;
+    // Write of count records already sorted, without holding them: each one is
+    // asked for once and its entry and blob bytes go to their places in the file
+    // side by side. the blob is read back for the checksum, it follows the index
+    static bool WriteSorted(const std::string &path, std::size_t count, std::uint64_t sequence, const RecordAt &at);
+
+    std::size_t Size() const { return count_; }
+    std::uint64_t Sequence() const { return sequence_; }
+    // sums the whole file and checks every entry, At trusts the index after it returned true
+    bool Verify() const;
+    SnapshotRecord At(std::size_t i) const;
+    bool Find(const HashKey &hash, SnapshotRecord &rec) const;
+
+private:
+    struct Header;
+    struct Entry;
+    class ChecksumWriter;
+
+    static void Prepare(std::vector<SnapshotRecord> &records, std::uint64_t sequence, Header &header);
+    static void InitHeader(std::size_t count, std::uint64_t sequence, Header &header);
+    static void FillEntry(const SnapshotRecord &rec, std::uint64_t blob_offset, Entry &entry);
+    static void WriteBody(const std::vector<SnapshotRecord> &records, Header &header, ChecksumWriter &writer);
+    // syncs the body, then writes the header and syncs it. 0 or the errno it failed with
+    static int WriteHeader(int fd, const Header &header);
+
+    SnapshotFile() : base_(nullptr), map_size_(0), entries_(nullptr), count_(0), blob_(nullptr), blob_size_(0), sequence_(0),
+        checksum_(0) {}
+    HashKey HashAt(std::size_t i) const;
+    // a valid hash and the url and visitors inside the blob
+    bool ValidEntry(std::size_t i) const;
+
+    std::string path_;
+    const char *base_;
+    std::size_t map_size_;
+    const Entry *entries_;
+    std::size_t count_;
+    const char *blob_;
+    std::size_t blob_size_;
+    std::uint64_t sequence_;
+    std::uint64_t checksum_;
+};
+
+} /* namespace sn */
+
+#endif // SN_SHORT_URL_SERVER_SNAPSHOT_H
@@ -2,67 +2,498 @@
 #define SN_SHORT_URL_SERVER_TASK_H
 
 #include "route.h"
+#include "rcu.h"
+#include "hash_key.h"
+#include "flat_set.h"
+#include "arena.h"
+#include "wal.h"
+#include "snapshot.h"
+#include "occupancy.h"
+#include "key_sequence.h"
+#include "url_hash.h"
+#include "timing_wheel.h"
+#include "click_counter.h"
+#include "hyperloglog.h"
+#include "hot_links.h"
+#include "click_series.h"
 #include <shared_mutex>
+#include <mutex>
+#include <condition_variable>
 #include <unordered_map>
-#include <unordered_set>
 #include <string>
+#include <string_view>
 #include <memory>
 #include <atomic>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <fstream>
+#include <functional>
 
 namespace sn {
 
+// the clock ttls count in, seconds since the epoch
+inline std::int64_t UnixSeconds() {
+    return std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+// what is kept of a link beyond its clicks, for the links that need it only.
+// mtx_ is taken with a hash shard lock held or while hash2recs_ is frozen,
+// neither goes along with a fork save, so its child never finds mtx_ held
+struct LinkStats {
+    std::mutex mtx_;
+    HyperLogLog visitors_;
+    ClickSeries series_;
+};
+
+// stored record, the record lives in a slab slot and its url bytes in a bump
+// arena, so every url and hash exists once and indexes only keep pointers
 struct ShortUrlRecord {
-    std::int64_t timestamp_;
+    // UnixSeconds the link runs out at, 0 for never. a url added again after
+    // it ran out gets its record back with a new one, read without locking
+    std::atomic<std::int64_t> expire_at_;
+    HashKey hash_;
+    std::string_view url_;
+    // redirects merged in by MergeClicks, the only writer
+    std::atomic<std::uint64_t> clicks_;
+    // owned, nullptr until MergeClicks has a visitor of the link
+    std::atomic<LinkStats*> stats_;
+
+    // probe for index lookups, refers to the caller's url
+    ShortUrlRecord(const HashKey &hash, std::string_view url = {}, const std::int64_t tm = 0) : expire_at_(tm), hash_(hash),
+        url_(url), clicks_(0), stats_(nullptr) {}
+    ShortUrlRecord(const ShortUrlRecord&) = delete;
+    ShortUrlRecord& operator=(const ShortUrlRecord&) = delete;
+
+    bool IsExpired(std::int64_t now) const {
+        auto expire_at = expire_at_.load(std::memory_order_relaxed);
+        return expire_at != 0 && expire_at <= now;
+    }
+    // only reads the clock for a record with a ttl
+    bool IsExpired() const { return expire_at_.load(std::memory_order_relaxed) != 0 && IsExpired(UnixSeconds()); }
+
+    static ShortUrlRecord* Create(SlabAllocator &slab, BumpArena &url_bytes,
+        std::string_view url, const HashKey &hash, const std::int64_t tm);
+    static void Destroy(void *rec);
+};
+
+struct ShortUrlInfo {
+    std::int64_t expire_at_;
     std::string url_;
-    std::string hash_;
-    ShortUrlRecord(const std::string &url, const std::string &hash, const std::int64_t tm) : url_(url), hash_(hash), timestamp_(tm) {}
+    HashKey hash_;
+    std::uint64_t clicks_ = 0;
 };
 
+struct RecordHashOf {
+    std::size_t operator()(const ShortUrlRecord *rec) const { return HashKeyHasher()(rec->hash_); }
+    bool operator()(const ShortUrlRecord *lhs, const ShortUrlRecord *rhs) const { return lhs->hash_ == rhs->hash_; }
+};
+struct RecordUrlOf {
+    std::size_t operator()(const ShortUrlRecord *rec) const { return UrlHasher()(rec->url_); }
+    bool operator()(const ShortUrlRecord *lhs, const ShortUrlRecord *rhs) const { return lhs->url_ == rhs->url_; }
+};
+typedef FlatSet<ShortUrlRecord*, RecordHashOf, RecordHashOf> HashRecordSet;
+typedef FlatSet<ShortUrlRecord*, RecordUrlOf, RecordUrlOf> UrlRecordSet;
+
+// when new hashs are expected to get one char longer
+struct HashWidthForecast {
+    int width_;
+    // md5 rounds per add of the last probe window
+    double probe_mean_;
+    // hashs of width_ taken and the count where the expected rounds reach the budget
+    std::size_t taken_;
+    double escalate_at_;
+    // seconds at the add rate of the last window, negative if unknown or never
+    double eta_sec_;
+};
+
+class RecordExport;
+class RecordStream;
+
 class ShortUrlMgr {
 public:
     ShortUrlMgr();
     ~ShortUrlMgr();
 
-    std::string AddUrl(const std::string &url);
-    bool DelUrl(const std::string &url);
-    bool DelHash(const std::string &hash);
-    ShortUrlRecord GetUrlInfo(const std::string &key, bool is_hash);
-    std::string GetUrl(const std::string &hash);
+    // ttl_sec 0 never runs out. an existing url keeps its hash and its ttl
+    // unless it ran out, then it takes this ttl. logged is false when the
+    // log could not write the change, it is in memory only then
+    std::string AddUrl(const std::string &url, std::int64_t ttl_sec = 0, bool *logged = nullptr);
+    // hashs in the order of urls. md5 mode digests the urls first, on the
+    // load threads for big batches, then the shard locks a chunk of them
+    // needs are taken once for it. a width escalation waits for the end of
+    // the chunk, the log is committed once for the whole batch
+    std::vector<std::string> AddUrls(const std::vector<std::string> &urls, bool *logged = nullptr);
+    bool DelUrl(const std::string &url, bool *logged = nullptr);
+    bool DelHash(const HashKey &hash, bool *logged = nullptr);
+    // deletes the records whose ttl ran out by now, in O(expired) off the
+    // expiry wheel. lookups miss them already before. main calls it every second
+    std::size_t ReapExpired();
+    ShortUrlInfo GetUrlInfo(const HashKey &hash);
+    ShortUrlInfo GetUrlInfo(const std::string &url);
+    std::string GetUrl(const HashKey &hash);
+    // a redirect to hash, buffered by the calling thread and not seen in
+    // clicks_ before the next MergeClicks. visitor is a hash of the client
+    // for the unique visitors of the link, 0 to count none
+    void CountClick(const HashKey &hash, std::uint64_t visitor = 0) { click_counter_.Count(hash, visitor); }
+    // adds the buffered clicks and visitors to their records, those of records
+    // deleted meanwhile are dropped. main calls it every second
+    std::size_t MergeClicks();
+    // estimated distinct visitors of a link, false if there is no such link
+    bool GetVisitors(const HashKey &hash, std::uint64_t &visitors);
+    // the links with the most redirects in the last window_sec, as of the last MergeClicks
+    std::vector<HotLinks::Entry> GetTopLinks(std::int64_t window_sec, std::size_t k);
+    // clicks of a link per minute of the day up to the last MergeClicks, the first
+    // is at UnixSeconds start. false if there is no such link
+    bool GetClickSeries(const HashKey &hash, std::int64_t &start, std::vector<std::uint64_t> &counts);
+    // urls in the order of hashs, empty for misses. resolves them a group at a
+    // time while the index slots and records of the next groups are prefetched
+    std::vector<std::string> GetUrls(const std::vector<HashKey> &hashs);
     std::string GetHash(const std::string &url);
-    std::string GenerateHash(const std::string &url) const;
+    // probes gets the hash rounds it took, width 0 is the current width
+    HashKey GenerateHash(const std::string &url, std::uint32_t *probes = nullptr, int width = 0) const;
+
+    // new hashs are spelled in alphabet, hashs given before keep theirs.
+    // rebuilds the occupancy index, set it before SetHashWidth and LoadRecords
+    void SetKeyAlphabet(KeyAlphabet alphabet);
+    KeyAlphabet GetKeyAlphabet() const { return key_alphabet_; }
+    // rebuilds the occupancy index, set it before LoadRecords
+    void SetHashWidth(int width);
+    int GetHashWidth() const { return hash_width_; }
+    // new hashs get one char longer once a window of adds averages more md5
+    // rounds than probes, up to max_width. hashs already given keep their
+    // width. probes <= 1 turns it off, set it before LoadRecords
+    void SetProbeBudget(double probes, int max_width);
+    HashWidthForecast ForecastHashWidth() const;
+    // sequence mode numbers new hashs of each width through a permutation keyed
+    // by secret, md5 mode hashs the url. set it before LoadRecords
+    void SetHashMode(HashMode mode, const std::string &secret);
+    // what md5 mode hashs urls with, wyhash gives other hashs than md5 for the
+    // same url, hashs already given stay. set it before LoadRecords
+    void SetUrlHashFunc(UrlHashFunc func) { url_hash_func_ = func; }
+    // taken keys of the current width in its whole key space
+    double GetOccupancyRatio() const;
+    std::size_t GetRecordCount();
+    // shard num is rounded up to power of two. only before LoadRecords, once
+    // lock free readers can be in the shards they are never replaced
+    void SetShardNum(int num);
+    int GetShardNum() const { return hash_shards_.size(); }
 
-    void SetHashWidth(int width) { hash_width_ = width; }
-    int GetHashWidth() { return hash_width_; }
+    // moves records out of mostly freed slab pages and url chunks, run before saving
+    void CompactRecords();
 
-    void SaveRecordsSync(const std::string &save_path);
+    // false if it was skipped or the snapshot could not be written
+    bool SaveRecordsSync(const std::string &save_path);
     void SaveRecordsAsync(const std::string &save_path);
     bool IsAsyncSaveing() const { return backuping_; }
+    // every record as of the call, handed out in batches while writers go on
+    // like during an async save, which is skipped until the export is gone.
+    // nothing paced by a client may hold it, see ExportSnapshot
+    std::unique_ptr<RecordExport> ExportRecords();
+    // the records one hash shard after the other without freezing anything,
+    // for a client that reads them at its own pace
+    RecordStream StreamRecords();
+    // the export with the visitor sketches in the urls.snap format. only record
+    // pointers are sorted, each record is read and its sketch serialized as its
+    // entry is written to a file in the temp folder. the freeze ends with that
+    // write, the file is opened as in and unlinked, so a slow reader holds only
+    // the file. false when it could not be written
+    bool ExportSnapshot(std::ifstream &in);
+    // a forked child writes the snapshot from its copy of the heap, the
+    // parent keeps the normal write path and only waits for the child
+    void SaveRecordsFork(const std::string &save_path);
+    bool IsForkSaving() const { return fork_saving_; }
+    // urls.snap is served from the mapped file at once and built into the
+    // shards in background, writers and url lookups wait for the build
     void LoadRecords(const std::string &save_path);
+    bool IsLoading() const { return loading_; }
+    // threads building the snapshot records and digesting big AddUrls batches, 0 lets OpenMP decide
+    void SetLoadThreads(int num) { load_threads_ = num; }
+    // MergeClicks keeps the clicks per minute too, saved to urls.series next to the snapshot
+    void SetClickSeries(bool on) { click_series_ = on; }
+    void WaitLoaded();
+    // records added, deleted or changed since the last save
     bool IsModified() const { return modified_; }
+    // only click counts merged since the last save, worth a save less often
+    bool IsClicksModified() const { return clicks_modified_; }
+    // log changes under save_path after LoadRecords, saving checkpoints the log.
+    // false if no segment could be opened, changes are in memory only then
+    bool OpenWal(const std::string &save_path, WalFsyncPolicy policy, std::int64_t interval_ms);
 
 private:
+    friend class RecordExport;
+    friend class RecordStream;
+
+    // records are routed to hash shard by hash_ and to url shard by url_,
+    // lock order is always url shard before hash shard
+    struct HashShard {
+        std::shared_mutex mtx_;
+        // owns the records, both in hash2recs_ and extra_hash2recs_
+        HashRecordSet hash2recs_;
+
+        HashRecordSet extra_hash2recs_;
+        HashRecordSet extra_deleted_hashs_;
+
+        // visible records only, read by GetUrl without locking mtx_
+        RcuHashIndex<ShortUrlRecord, HashKey, &ShortUrlRecord::hash_, HashKeyHasher> index_;
+    };
+    struct UrlShard {
+        std::shared_mutex mtx_;
+        UrlRecordSet url2recs_;
+
+        UrlRecordSet extra_url2recs_;
+    };
+    struct RecordArena {
+        RecordArena() : slab_(sizeof(ShortUrlRecord)) {}
+        SlabAllocator slab_;
+        BumpArena url_bytes_;
+    };
+    // the mapped snapshot while it is being built, with the hashs deleted by the log
+    // after it, sorted like the snapshot index so the build merges instead of probing
+    struct LazySnapshot {
+        std::unique_ptr<SnapshotFile> file_;
+        std::vector<HashKey> dropped_;
+        // of urls.series, attached once the records are built
+        std::vector<std::pair<HashKey, std::string>> series_;
+
+        bool IsDropped(const HashKey &hash) const { return std::binary_search(dropped_.begin(), dropped_.end(), hash); }
+    };
+    typedef std::vector<std::unique_lock<std::shared_mutex>> ShardGuards;
+    static constexpr std::size_t LOAD_CHUNK_SIZE = 64 * 1024;
+    static constexpr std::uint64_t PROBE_WINDOW = 1024;
+    // urls AddUrls adds under one round of shard locks, unless one of them needs another shard
+    static constexpr std::size_t ADD_BATCH_SIZE = 256;
+    // chunks of a batch from which its digests are worked out in parallel
+    static constexpr long ADD_PARALLEL_CHUNKS = 16;
+    // hashs GetUrls resolves at once, prefetches run one and two groups ahead
+    static constexpr std::size_t GET_BATCH_GROUP = 16;
+    // sequence numbers are logged in leases, a restart skips the rest of one
+    static constexpr std::uint64_t SEQUENCE_LEASE = 1024;
+
+    std::size_t HashShardIndex(const HashKey &hash) const { return HashKeyHasher()(hash) & shard_mask_; }
+    std::size_t UrlShardIndex(std::string_view url) const { return UrlHasher()(url) & shard_mask_; }
+    HashShard& GetHashShard(const HashKey &hash) const { return *hash_shards_[HashShardIndex(hash)]; }
+    UrlShard& GetUrlShard(std::string_view url) const { return *url_shards_[UrlShardIndex(url)]; }
+    ShardGuards LockAllShards();
+    // the marked shards in the order of LockAllShards, url shards before hash shards
+    ShardGuards LockShards(const std::vector<char> &url_marks, const std::vector<char> &hash_marks);
+    RecordArena& GetArena(const HashKey &hash) const { return *arenas_[HashKeyHasher()(hash) & (arenas_.size() - 1)]; }
+    // locked when the caller holds every shard lock the add takes, digest is md5 of url when it has it
+    std::string DoAddUrl(const std::string &url, std::int64_t expire_at, std::uint64_t &wal_seq,
+        const unsigned char *digest = nullptr, bool locked = false);
+    // whether DoAddUrl of url only needs its url shard and the marked hash shards,
+    // first is the first round hash. caller holds those locks
+    bool CanAddLocked(const std::string &url, const HashKey &first, const HashOccupancy *occupancy, int width,
+        const std::vector<char> &hash_marks) const;
+    // caller holds the url and hash shard locks of info, brings it back with expire_at
+    void ReviveRecord(ShortUrlRecord *info, std::int64_t expire_at, std::uint64_t &wal_seq);
+    // takes the expiry lock, nothing for expire_at 0
+    void ScheduleExpiry(const HashKey &hash, std::int64_t expire_at);
+    HashKey DoGenerateHash(const std::string &url, std::uint32_t *probes, int width, const unsigned char *digest,
+        bool locked) const;
+    // widens the hashs when CountProbes asked for it, takes all shard locks then
+    void EscalateIfPending();
+    // load_threads_, all cores when it is 0
+    int GetWorkerThreads() const;
+    bool DoDelUrl(const std::string &url, std::uint64_t &wal_seq);
+    // expired_by only deletes a record that ran out by then
+    bool DoDelHash(const HashKey &hash, std::uint64_t &wal_seq, std::int64_t expired_by = 0);
+    std::uint64_t LogRecord(const ShortUrlRecord *info);
+    std::uint64_t LogTombstone(const HashKey &hash);
+    // waits for wal_seq of LogRecord or LogTombstone, 0 for nothing logged
+    bool CommitLog(std::uint64_t wal_seq, bool *logged);
+    // caller blocks log appends, returns the closed segment and the lease the snapshot keeps
+    std::uint64_t RotateWal(std::uint64_t &sequence);
+    // the next free hash of the sequence, falls back to GenerateHash when it can not give one
+    HashKey NextSequenceHash(const std::string &url, std::uint32_t &probes, bool locked = false);
+    void ExtendSequenceLease(std::uint64_t seq);
+    // caller holds all shard locks, the sequence starts over when the width changed
+    void ResetSequence();
+    // a stale answer is fine, the caller checks again under the unique lock
+    bool IsHashFree(const HashOccupancy *occupancy, const HashKey &hash, bool locked = false) const;
+    // the number of records skipped as unreadable
+    std::size_t LoadRecordFile(const std::string &file_path, LazySnapshot *lazy = nullptr);
+    void BuildSnapshotRecords();
+    // caller holds Rcu::ReadGuard and loaded lazy before missing the index
+    bool FindSnapshotRecord(const LazySnapshot *lazy, const HashKey &hash, SnapshotRecord &rec) const;
+    // how far a snapshot write came, a forked child hands it to the parent to log
+    struct SaveStatus {
+        enum Step : std::int32_t { OK = 0, WRITE_SNAPSHOT, RENAME_SNAPSHOT, REMOVE_TXT, WRITE_SERIES };
+        std::int32_t step_;
+        std::int32_t err_;
+    };
+    bool WriteSnapshot(const std::string &save_path, std::uint64_t sequence);
+    // WriteSnapshot without logging, for a forked child. status gets the step that
+    // failed, also after a commit when only the cleanup or the series failed
+    bool WriteSnapshotQuiet(const std::string &save_path, std::uint64_t sequence, SaveStatus &status);
+    static void LogSaveStatus(const std::string &save_path, const SaveStatus &status);
+    static bool CommitSnapshot(const std::string &save_path, bool keep_txt, SaveStatus &status);
+    // caller holds all shard locks, series of links gone since are dropped
+    void AttachClickSeries(std::vector<std::pair<HashKey, std::string>> &series);
+    // caller holds the shard lock, nullptr if hash has no live record
+    ShortUrlRecord* FindStatsRecord(HashShard &hash_shard, const HashKey &hash) const;
+    // caller holds all shard locks, expect is the number of records about to be added
+    void RebuildOccupancy(std::size_t expect);
+    bool IsOccupancyFull() const;
+    // counts the rounds of one new hash, flags an escalation when a window is over budget
+    void CountProbes(std::uint32_t probes);
+    // caller holds all shard locks, false at the max width
+    bool EscalateHashWidth(const char *reason);
+    // caller holds all shard locks, after loading: resumes the widest width given
+    // out or leased, then escalates while the load alone is over budget
+    void EscalateByLoad();
+    ShortUrlRecord* CreateRecord(std::string_view url, const HashKey &hash, const std::int64_t tm);
+    bool CompactRecord(const HashKey &hash);
+    // caller holds all shard locks, hash2recs_ stays as it is from the first
+    // begin to the last end, which merges the extra sets back
+    void BeginFreeze();
+    void EndFreeze();
+
     std::atomic<bool> backuping_;
+    // async save and exports holding hash2recs_ frozen, changed under all shard locks
+    int freeze_refs_;
     std::atomic<bool> modified_;
-    std::shared_mutex mtx_;
-    int hash_width_;
-    std::unordered_map<std::string, std::shared_ptr<ShortUrlRecord>> url2recs_;
-    std::unordered_map<std::string, std::shared_ptr<ShortUrlRecord>> hash2recs_;
+    std::atomic<bool> clicks_modified_;
+    // urls.txt had records LoadRecords could not read, saving does not remove it then
+    bool keep_txt_;
+    // LoadRecords was called, the shards stay as they are from then on
+    bool started_;
+    std::atomic<bool> loading_;
+    std::atomic<bool> fork_saving_;
+    std::atomic<LazySnapshot*> lazy_snapshot_;
+    std::mutex load_mtx_;
+    std::condition_variable load_cv_;
+    std::atomic<int> hash_width_;
+    int hash_width_max_;
+    double probe_budget_;
+    // the current probe window and what the last one measured
+    std::atomic<std::uint64_t> window_adds_;
+    std::atomic<std::uint64_t> window_probes_;
+    std::atomic<std::int64_t> window_start_us_;
+    std::atomic<double> probe_mean_;
+    std::atomic<double> add_rate_;
+    std::atomic<bool> escalate_pending_;
+    KeyAlphabet key_alphabet_;
+    HashMode hash_mode_;
+    UrlHashFunc url_hash_func_;
+    std::unique_ptr<KeyPermutation> permutation_;
+    // KeyPermutation::Pack of the next sequence number and of the lease end,
+    // the lease only grows under sequence_mtx_, taken after any shard lock
+    std::atomic<std::uint64_t> sequence_next_;
+    std::atomic<std::uint64_t> sequence_leased_;
+    std::mutex sequence_mtx_;
+    std::size_t shard_mask_;
+    int load_threads_;
+    bool click_series_;
+    // hashs of hash_width_ taken, changed under the hash shard lock and read by
+    // GenerateHash without it, replaced as a whole under all shard locks
+    std::atomic<HashOccupancy*> occupancy_;
+    // one arena per shard at most, records keep theirs across resharding
+    std::vector<std::unique_ptr<RecordArena>> arenas_;
+    std::vector<std::unique_ptr<HashShard>> hash_shards_;
+    std::vector<std::unique_ptr<UrlShard>> url_shards_;
+    std::unique_ptr<WriteAheadLog> wal_;
+    // one snapshot writer at a time, it owns urls.snap.tmp and the segment removal
+    std::mutex save_mtx_;
+    // when the records with a ttl run out, entries of records deleted or given
+    // a new ttl meanwhile stay until due. expiry_mtx_ is taken after any shard lock
+    TimingWheel expiry_wheel_;
+    std::mutex expiry_mtx_;
+    ClickCounter click_counter_;
+    // drained by MergeClicks while a snapshot is built, one entry per link
+    // clicked, applied by the first merge after the build. only it touches them
+    std::unordered_map<HashKey, std::uint64_t, HashKeyHasher> loading_clicks_;
+    std::unordered_map<HashKey, HyperLogLog, HashKeyHasher> loading_visitors_;
+    // fed the drained clicks by MergeClicks, hot_mtx_ is taken after no other lock
+    HotLinks hot_links_;
+    std::mutex hot_mtx_;
+};
+
+// what ShortUrlMgr::ExportRecords hands out, the records stay in place until
+// it is destroyed, so it should not outlive a slow reader by much
+class RecordExport {
+public:
+    ~RecordExport();
+    RecordExport(const RecordExport&) = delete;
+    RecordExport& operator=(const RecordExport&) = delete;
+
+    std::size_t Size() const { return count_; }
+    // the sequence lease when the export started, for a snapshot of it
+    std::uint64_t Sequence() const { return sequence_; }
+    // appends up to max records to out shard by shard, false once all were given.
+    // they stay valid as long as the export
+    bool Next(std::size_t max, std::vector<const ShortUrlRecord*> &out);
+
+private:
+    friend class ShortUrlMgr;
+    RecordExport(ShortUrlMgr *mgr, std::size_t count, std::uint64_t sequence);
 
-    std::unordered_map<std::string, std::shared_ptr<ShortUrlRecord>> extra_url2recs_;
-    std::unordered_map<std::string, std::shared_ptr<ShortUrlRecord>> extra_hash2recs_;
-    std::unordered_set<std::string> extra_deleted_hashs_;
+    ShortUrlMgr *mgr_;
+    std::size_t count_;
+    std::uint64_t sequence_;
+    std::size_t shard_;
+    HashRecordSet::Iterator it_;
+};
+
+// what ShortUrlMgr::StreamRecords hands out. a shard has its hashs listed
+// under its shared lock when the walk gets to it, the records are then
+// copied a batch at a time like GetUrl reads them. one added or deleted
+// after the walk started may be in it or not, one that ran out is left out
+class RecordStream {
+public:
+    // appends copies of up to max records to out, false once the walk is over.
+    // out may get fewer when records went away meanwhile
+    bool Next(std::size_t max, std::vector<ShortUrlInfo> &out);
+
+private:
+    friend class ShortUrlMgr;
+    explicit RecordStream(ShortUrlMgr *mgr) : mgr_(mgr), shard_(0), pos_(0) {}
+
+    ShortUrlMgr *mgr_;
+    // the next shard to list
+    std::size_t shard_;
+    std::vector<HashKey> hashs_;
+    std::size_t pos_;
 };
 
 struct ServerConfig : public BaseServerConfig {
     std::string data_path_;
     std::string webpage_html_;
     std::int64_t save_internal_;
+    // saves with only new clicks wait this long instead of save_internal_
+    std::int64_t click_save_internal_;
     bool save_async_;
+    bool save_fork_;
+    std::string wal_fsync_;
+    std::int64_t wal_fsync_ms_;
+    std::string key_alphabet_;
     int hash_width_;
+    int hash_width_max_;
+    double hash_probe_budget_;
+    std::string hash_mode_;
+    std::string hash_func_;
+    std::string sequence_secret_;
+    int shard_num_;
+    int load_threads_;
+    // urls one /add/batch request may carry, hashs one /get/batch may
+    int add_batch_max_;
+    int get_batch_max_;
+    // counts distinct client addresses per link along with the clicks
+    bool unique_visitors_;
+    // clicks per minute of the last day per link, at /stats/series
+    bool click_series_;
 
     sn::ShortUrlMgr *mgr_;
 };
 
+// every option at its default, for the server and the tools reading the same ini
+extern ServerConfig DefaultServerConfig(ShortUrlMgr *mgr);
+
+// the shard and key options of cfg onto mgr in the order LoadRecords needs,
+// unknown names fall back to the defaults with a warning
+extern void ApplyKeyConfig(ShortUrlMgr &mgr, const ServerConfig &cfg);
+
 } /* namespace sn */
 
 #endif // SN_SHORT_URL_SERVER_TASK_H
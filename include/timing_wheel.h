@@ -0,0 +1,53 @@
+#ifndef SN_SHORT_URL_SERVER_TIMING_WHEEL_H
+#define SN_SHORT_URL_SERVER_TIMING_WHEEL_H
+
+#include "hash_key.h"
+#include <cstdint>
+#include <vector>
+
+namespace sn {
+
+// hierarchical timing wheel of one second ticks. level 0 has a slot for each
+// of the next 256 seconds, every level above 64 slots as wide as the whole
+// level below. each time level 0 wraps the next slot of level 1 is moved
+// down, and so on up, so a tick costs what is due plus what cascades instead
+// of a scan of everything scheduled. entries are not cancelled, the caller
+// checks a due key against what it holds now
+class TimingWheel {
+public:
+    struct Entry {
+        HashKey key_;
+        std::int64_t expire_at_;
+    };
+
+    explicit TimingWheel(std::int64_t now);
+    TimingWheel(const TimingWheel&) = delete;
+    TimingWheel& operator=(const TimingWheel&) = delete;
+
+    // an expire_at not after the wheel's now is due at the next Advance
+    void Add(const HashKey &key, std::int64_t expire_at);
+    // ticks up to now and appends every entry due by then to expired
+    void Advance(std::int64_t now, std::vector<Entry> &expired);
+    std::size_t Size() const { return size_; }
+    std::int64_t Now() const { return now_; }
+
+private:
+    static constexpr int LEVELS = 5;
+    static constexpr int ROOT_BITS = 8;
+    static constexpr int LEVEL_BITS = 6;
+
+    // the first second bit a level's slots are indexed by
+    static int Shift(int level) { return level == 0 ? 0 : ROOT_BITS + LEVEL_BITS * (level - 1); }
+    static std::int64_t Mask(int level) { return (std::int64_t(1) << (level == 0 ? ROOT_BITS : LEVEL_BITS)) - 1; }
+    void Place(const Entry &entry);
+    void Take(std::vector<Entry> &slot, std::vector<Entry> &expired);
+
+    std::int64_t now_;
+    std::size_t size_;
+    std::vector<Entry> due_;
+    std::vector<std::vector<Entry>> levels_[LEVELS];
+};
+
+} /* namespace sn */
+
+#endif // SN_SHORT_URL_SERVER_TIMING_WHEEL_H
@@ -0,0 +1,109 @@
+#ifndef SN_SHORT_URL_SERVER_URL_HASH_H
+#define SN_SHORT_URL_SERVER_URL_HASH_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+
+namespace sn {
+
+enum UrlHashFunc {
+    URL_HASH_MD5 = 0,           // what keys always were, retries append a space to the url
+    URL_HASH_WYHASH,            // WyHash128, retries change the seed
+};
+
+extern bool ParseUrlHashFunc(const std::string &name, UrlHashFunc &func);
+
+// wyhash, final version 4, with its default secret
+namespace wyhash {
+
+static const std::uint64_t SECRET[4] = {
+    0x2d358dccaa6c78a5ull, 0x8bb84b93962eacc9ull, 0x4b33a62ed433d4a3ull, 0x4d5a2da51de1aa47ull };
+
+static inline void Mum(std::uint64_t &a, std::uint64_t &b) {
+    auto r = static_cast<unsigned __int128>(a) * b;
+    a = static_cast<std::uint64_t>(r);
+    b = static_cast<std::uint64_t>(r >> 64);
+}
+static inline std::uint64_t Mix(std::uint64_t a, std::uint64_t b) {
+    Mum(a, b);
+    return a ^ b;
+}
+static inline std::uint64_t Read8(const std::uint8_t *p) {
+    std::uint64_t v;
+    std::memcpy(&v, p, 8);
+    return v;
+}
+static inline std::uint64_t Read4(const std::uint8_t *p) {
+    std::uint32_t v;
+    std::memcpy(&v, p, 4);
+    return v;
+}
+static inline std::uint64_t Read3(const std::uint8_t *p, std::size_t k) {
+    return (static_cast<std::uint64_t>(p[0]) << 16) | (static_cast<std::uint64_t>(p[k >> 1]) << 8) | p[k - 1];
+}
+
+} /* namespace wyhash */
+
+inline std::uint64_t WyHash64(const void *key, std::size_t len, std::uint64_t seed) {
+    using namespace wyhash;
+    auto p = static_cast<const std::uint8_t*>(key);
+    seed ^= Mix(seed ^ SECRET[0], SECRET[1]);
+    std::uint64_t a, b;
+    if (len <= 16) {
+        if (len >= 4) {
+            a = (Read4(p) << 32) | Read4(p + ((len >> 3) << 2));
+            b = (Read4(p + len - 4) << 32) | Read4(p + len - 4 - ((len >> 3) << 2));
+        } else if (len > 0) {
+            a = Read3(p, len);
+            b = 0;
+        } else {
+            a = b = 0;
+        }
+    } else {
+        auto i = len;
+        if (i > 48) {
+            auto see1 = seed, see2 = seed;
+            do {
+                seed = Mix(Read8(p) ^ SECRET[1], Read8(p + 8) ^ seed);
+                see1 = Mix(Read8(p + 16) ^ SECRET[2], Read8(p + 24) ^ see1);
+                see2 = Mix(Read8(p + 32) ^ SECRET[3], Read8(p + 40) ^ see2);
+                p += 48;
+                i -= 48;
+            } while (i > 48);
+            seed ^= see1 ^ see2;
+        }
+        while (i > 16) {
+            seed = Mix(Read8(p) ^ SECRET[1], Read8(p + 8) ^ seed);
+            i -= 16;
+            p += 16;
+        }
+        a = Read8(p + i - 16);
+        b = Read8(p + i - 8);
+    }
+    a ^= SECRET[1];
+    b ^= seed;
+    Mum(a, b);
+    return Mix(a ^ SECRET[0] ^ len, b ^ SECRET[1]);
+}
+
+// two wyhash lanes of unrelated seeds, written big endian like a md5 digest
+inline void WyHash128(const void *key, std::size_t len, std::uint64_t seed, unsigned char digest[16]) {
+    auto hi = WyHash64(key, len, seed);
+    auto lo = WyHash64(key, len, seed ^ 0x9E3779B97F4A7C15ull);
+    for (int i = 7; i >= 0; --i, hi >>= 8, lo >>= 8) {
+        digest[i] = static_cast<unsigned char>(hi);
+        digest[i + 8] = static_cast<unsigned char>(lo);
+    }
+}
+
+// hashs urls for the url indexes and shards, only lives in memory
+struct UrlHasher {
+    std::size_t operator()(std::string_view url) const { return WyHash64(url.data(), url.size(), 0); }
+};
+
+} /* namespace sn */
+
+#endif // SN_SHORT_URL_SERVER_URL_HASH_H
@@ -0,0 +1,28 @@
+#ifndef SN_SHORT_URL_SERVER_MD5_LANES_H
+#define SN_SHORT_URL_SERVER_MD5_LANES_H
+
+#include "util/md5.h"
+#include <cstddef>
+#include <string_view>
+
+namespace md5 {
+
+/* What DigestBatch runs on, one input per simd lane. */
+enum LaneIsa {
+    LANE_ISA_SCALAR = 0,    /* MD5 one input after another */
+    LANE_ISA_SSE2,          /* 4 lanes */
+    LANE_ISA_AVX2,          /* 8 lanes */
+};
+
+/* The widest the cpu runs, checked once. */
+extern LaneIsa DetectLaneIsa();
+extern const char* LaneIsaName(LaneIsa isa);
+
+/* digests[i] gets the same bytes as MD5(inputs[i]).digest(). An isa the
+cpu can not run falls back to the widest it can. */
+extern void DigestBatch(const std::string_view *inputs, size_t num, byte (*digests)[16]);
+extern void DigestBatch(const std::string_view *inputs, size_t num, byte (*digests)[16], LaneIsa isa);
+
+} /* namespace md5 */
+
+#endif // SN_SHORT_URL_SERVER_MD5_LANES_H
@@ -0,0 +1,86 @@
+#ifndef SN_SHORT_URL_SERVER_WAL_H
+#define SN_SHORT_URL_SERVER_WAL_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace sn {
+
+enum WalFsyncPolicy {
+    WAL_FSYNC_ALWAYS = 0,       // every commit waits for fdatasync
+    WAL_FSYNC_INTERVAL,         // a background thread syncs every interval
+    WAL_FSYNC_NEVER,            // only written to the os
+};
+
+extern bool ParseWalFsyncPolicy(const std::string &name, WalFsyncPolicy &policy);
+
+// append-only log in segments "urls.wal.<id>" next to urls.txt, entries use
+// the urls.txt record format so loading just replays them after the snapshot.
+// writers Append while holding their shard lock, so the order matches the
+// memory state, then Commit after unlocking: the first committer writes the
+// batch of everyone waiting with one write and one fdatasync. a failed write
+// puts its batch back in front of the buffer and fails its commits, the next
+// commit cuts the torn tail off the segment, or starts a new one, and writes
+// the batch again
+class WriteAheadLog {
+public:
+    WriteAheadLog(const std::string &folder, WalFsyncPolicy policy, std::int64_t interval_ms);
+    ~WriteAheadLog();
+    WriteAheadLog(const WriteAheadLog&) = delete;
+    WriteAheadLog& operator=(const WriteAheadLog&) = delete;
+
+    // returns the sequence to commit
+    std::uint64_t Append(const std::string &entry);
+    // false if seq did not get to the file, or to the disk for WAL_FSYNC_ALWAYS
+    bool Commit(std::uint64_t seq);
+    // a write, sync or segment open failed and no write got past it yet
+    bool Failed();
+    // appended entries are not in the file yet, as after a failed write
+    bool Unwritten();
+
+    // appends must be blocked by the caller, returns the id of the closed segment
+    std::uint64_t Rotate();
+    // drops the segments covered by a checkpoint
+    void RemoveSegments(std::uint64_t last_id);
+
+    static std::vector<std::string> ListSegments(const std::string &folder);
+
+private:
+    std::string SegmentPath(std::uint64_t id) const;
+    bool OpenSegment(std::uint64_t id);
+    bool WriteBuffer(int fd, const std::string &buf);
+    // after a failure: truncates the segment to what was written whole, or opens the next one
+    bool Repair();
+    void SyncLoop();
+
+    std::string folder_;
+    WalFsyncPolicy policy_;
+    std::int64_t interval_ms_;
+
+    std::mutex mtx_;
+    std::condition_variable cv_;
+    std::condition_variable sync_cv_;
+    int fd_;
+    std::uint64_t segment_id_;
+    // bytes of fd_ written by writes that succeeded
+    std::uint64_t segment_size_;
+    std::string buf_;
+    std::uint64_t append_seq_;
+    std::uint64_t written_seq_;
+    // a leader is writing or the sync thread is syncing fd_
+    bool writing_;
+    bool syncing_;
+    bool dirty_;
+    // a write or sync failed, the segment may be torn after segment_size_
+    bool failed_;
+    bool stop_;
+    std::thread sync_thr_;
+};
+
+} /* namespace sn */
+
+#endif // SN_SHORT_URL_SERVER_WAL_H
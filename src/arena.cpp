@@ -0,0 +1,202 @@
+#include "arena.h"
+
+#include <cstdlib>
+#include <new>
+
+namespace sn {
+
+static inline std::size_t AlignUp(std::size_t size, std::size_t align) {
+    return (size + align - 1) & ~(align - 1);
+}
+
+SlabAllocator::SlabAllocator(std::size_t slot_size) :
+    slot_size_(AlignUp(slot_size < sizeof(void*) ? sizeof(void*) : slot_size, alignof(std::max_align_t))),
+    slot_offset_(AlignUp(sizeof(Page), alignof(std::max_align_t))),
+    slots_per_page_((PAGE_SIZE - slot_offset_) / slot_size_), partial_(nullptr), used_cnt_(0) {}
+
+SlabAllocator::~SlabAllocator() {
+    for (auto page : pages_)
+        std::free(page);
+}
+
+void SlabAllocator::Link(Page *page) {
+    page->prev_ = nullptr;
+    page->next_ = partial_;
+    if (partial_ != nullptr)
+        partial_->prev_ = page;
+    partial_ = page;
+}
+
+void SlabAllocator::Unlink(Page *page) {
+    if (page->prev_ != nullptr)
+        page->prev_->next_ = page->next_;
+    else
+        partial_ = page->next_;
+    if (page->next_ != nullptr)
+        page->next_->prev_ = page->prev_;
+    page->prev_ = page->next_ = nullptr;
+}
+
+void* SlabAllocator::Alloc() {
+    std::lock_guard<std::mutex> guard(mtx_);
+    auto page = partial_;
+    if (page == nullptr) {
+        page = static_cast<Page*>(std::aligned_alloc(PAGE_SIZE, PAGE_SIZE));
+        if (page == nullptr)
+            throw std::bad_alloc();
+        *page = Page{ this, nullptr, nullptr, nullptr, 0, 0, pages_.size(), false };
+        pages_.emplace_back(page);
+        Link(page);
+    }
+    void *ret;
+    if (page->free_ != nullptr) {
+        ret = page->free_;
+        page->free_ = *static_cast<void**>(ret);
+    }
+    else
+        ret = reinterpret_cast<char*>(page) + slot_offset_ + slot_size_ * page->bumped_++;
+    if (++page->used_ == slots_per_page_)
+        Unlink(page);
+    ++used_cnt_;
+    return ret;
+}
+
+void SlabAllocator::Free(void *ptr) {
+    auto page = PageOf(ptr);
+    auto owner = page->owner_;
+    std::lock_guard<std::mutex> guard(owner->mtx_);
+    owner->FreeInPage(page, ptr);
+}
+
+void SlabAllocator::FreeInPage(Page *page, void *ptr) {
+    *static_cast<void**>(ptr) = page->free_;
+    page->free_ = ptr;
+    --used_cnt_;
+    auto was_full = page->used_-- == slots_per_page_;
+    // keep one empty page around, alloc and free often take turns at the edge
+    if (page->used_ == 0 && (page->draining_ || partial_ != page || page->next_ != nullptr)) {
+        if (!page->draining_ && !was_full)
+            Unlink(page);
+        pages_.back()->index_ = page->index_;
+        pages_[page->index_] = pages_.back();
+        pages_.pop_back();
+        std::free(page);
+        return;
+    }
+    if (was_full && !page->draining_)
+        Link(page);
+}
+
+void SlabAllocator::BeginCompact(std::size_t ratio) {
+    std::lock_guard<std::mutex> guard(mtx_);
+    for (auto page : pages_) {
+        if (page->draining_ || page->used_ * ratio >= slots_per_page_)
+            continue;
+        Unlink(page);
+        page->draining_ = true;
+    }
+}
+
+bool SlabAllocator::IsDraining(const void *ptr) {
+    auto page = PageOf(ptr);
+    std::lock_guard<std::mutex> guard(page->owner_->mtx_);
+    return page->draining_;
+}
+
+std::size_t SlabAllocator::PageCount() const {
+    std::lock_guard<std::mutex> guard(mtx_);
+    return pages_.size();
+}
+
+std::size_t SlabAllocator::UsedSlots() const {
+    std::lock_guard<std::mutex> guard(mtx_);
+    return used_cnt_;
+}
+
+BumpArena::BumpArena() : cur_(nullptr), reserved_(0), live_(0) {}
+
+BumpArena::~BumpArena() {
+    for (auto chunk : chunks_)
+        std::free(chunk);
+}
+
+BumpArena::Chunk* BumpArena::NewChunk(std::size_t size) {
+    size = AlignUp(size, CHUNK_SIZE);
+    auto chunk = static_cast<Chunk*>(std::aligned_alloc(CHUNK_SIZE, size));
+    if (chunk == nullptr)
+        throw std::bad_alloc();
+    *chunk = Chunk{ this, size, sizeof(Chunk), 0, chunks_.size(), false };
+    chunks_.emplace_back(chunk);
+    reserved_ += size;
+    return chunk;
+}
+
+void BumpArena::ReleaseChunk(Chunk *chunk) {
+    chunks_.back()->index_ = chunk->index_;
+    chunks_[chunk->index_] = chunks_.back();
+    chunks_.pop_back();
+    reserved_ -= chunk->size_;
+    std::free(chunk);
+}
+
+char* BumpArena::Alloc(std::size_t size) {
+    if (size == 0)
+        return nullptr;
+    std::lock_guard<std::mutex> guard(mtx_);
+    Chunk *chunk = cur_;
+    if (chunk == nullptr || chunk->bumped_ + size > chunk->size_) {
+        // big strings get a chunk of their own, the current one keeps filling
+        if (sizeof(Chunk) + size > CHUNK_SIZE / 4)
+            chunk = NewChunk(sizeof(Chunk) + size);
+        else {
+            if (cur_ != nullptr && cur_->live_ == 0)
+                ReleaseChunk(cur_);
+            chunk = cur_ = NewChunk(CHUNK_SIZE);
+        }
+    }
+    auto ret = reinterpret_cast<char*>(chunk) + chunk->bumped_;
+    chunk->bumped_ += size;
+    chunk->live_ += size;
+    live_ += size;
+    return ret;
+}
+
+void BumpArena::Free(const char *ptr, std::size_t size) {
+    if (ptr == nullptr || size == 0)
+        return;
+    auto chunk = ChunkOf(ptr);
+    auto owner = chunk->owner_;
+    std::lock_guard<std::mutex> guard(owner->mtx_);
+    chunk->live_ -= size;
+    owner->live_ -= size;
+    if (chunk->live_ == 0 && chunk != owner->cur_)
+        owner->ReleaseChunk(chunk);
+}
+
+void BumpArena::BeginCompact(std::size_t ratio) {
+    std::lock_guard<std::mutex> guard(mtx_);
+    for (auto chunk : chunks_) {
+        if (chunk != cur_ && chunk->live_ * ratio < chunk->size_)
+            chunk->sparse_ = true;
+    }
+}
+
+bool BumpArena::IsSparse(const char *ptr) {
+    if (ptr == nullptr)
+        return false;
+    auto chunk = ChunkOf(ptr);
+    std::lock_guard<std::mutex> guard(chunk->owner_->mtx_);
+    return chunk->sparse_;
+}
+
+std::size_t BumpArena::ReservedBytes() const {
+    std::lock_guard<std::mutex> guard(mtx_);
+    return reserved_;
+}
+
+std::size_t BumpArena::LiveBytes() const {
+    std::lock_guard<std::mutex> guard(mtx_);
+    return live_;
+}
+
+} /* namespace sn */
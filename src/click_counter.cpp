@@ -0,0 +1,119 @@
+#include "click_counter.h"
+
+namespace sn {
+
+namespace {
+
+std::atomic<std::uint64_t> g_counter_id{1};
+
+struct LocalCache {
+    std::uint64_t id_ = 0;
+    void *buffer_ = nullptr;
+};
+
+thread_local LocalCache t_cache;
+
+} /* namespace */
+
+ClickCounter::Buffer::~Buffer() {
+    for (auto list : { head_, spares_.load() }) {
+        while (list != nullptr) {
+            auto next = list->next_.load(std::memory_order_relaxed);
+            delete list;
+            list = next;
+        }
+    }
+}
+
+ClickCounter::ClickCounter() : id_(g_counter_id.fetch_add(1, std::memory_order_relaxed)) {}
+
+ClickCounter::~ClickCounter() {}
+
+// mtx_ is only taken the first time a thread counts, or when it counts on another counter
+ClickCounter::Buffer* ClickCounter::LocalBuffer() {
+    if (t_cache.id_ == id_)
+        return static_cast<Buffer*>(t_cache.buffer_);
+    std::lock_guard<std::mutex> guard(mtx_);
+    auto &buffer = buffers_[std::this_thread::get_id()];
+    if (!buffer)
+        buffer.reset(new Buffer());
+    t_cache.id_ = id_;
+    t_cache.buffer_ = buffer.get();
+    return buffer.get();
+}
+
+ClickCounter::Block* ClickCounter::NewBlock(Buffer &buffer) {
+    auto block = buffer.spares_.load(std::memory_order_acquire);
+    while (block != nullptr &&
+            !buffer.spares_.compare_exchange_weak(block, block->next_.load(std::memory_order_relaxed),
+                std::memory_order_acquire))
+        ;
+    if (block == nullptr)
+        return new Block();
+    buffer.spare_count_.fetch_sub(1, std::memory_order_relaxed);
+    block->size_.store(0, std::memory_order_relaxed);
+    block->next_.store(nullptr, std::memory_order_relaxed);
+    return block;
+}
+
+void ClickCounter::RecycleBlock(Buffer &buffer, Block *block) {
+    if (buffer.spare_count_.load(std::memory_order_relaxed) >= SPARE_BLOCKS) {
+        delete block;
+        return;
+    }
+    buffer.spare_count_.fetch_add(1, std::memory_order_relaxed);
+    auto top = buffer.spares_.load(std::memory_order_relaxed);
+    do {
+        block->next_.store(top, std::memory_order_relaxed);
+    } while (!buffer.spares_.compare_exchange_weak(top, block, std::memory_order_release, std::memory_order_relaxed));
+}
+
+void ClickCounter::Count(const HashKey &hash, std::uint64_t visitor) {
+    auto buffer = LocalBuffer();
+    auto block = buffer->tail_;
+    auto size = block->size_.load(std::memory_order_relaxed);
+    if (size == BLOCK_CLICKS) {
+        auto next = NewBlock(*buffer);
+        block->next_.store(next, std::memory_order_release);
+        buffer->tail_ = block = next;
+        size = 0;
+    }
+    block->clicks_[size] = Click{ hash, visitor };
+    block->size_.store(size + 1, std::memory_order_release);
+}
+
+void ClickCounter::Drain(std::vector<std::pair<HashKey, std::uint64_t>> &clicks,
+        std::vector<std::pair<HashKey, std::uint64_t>> &visits) {
+    visits.clear();
+    // summed as they are read, hot links make most of the clicks and keep the map small
+    std::unordered_map<HashKey, std::uint64_t, HashKeyHasher> sums;
+    {
+        std::lock_guard<std::mutex> guard(mtx_);
+        for (auto &entry : buffers_) {
+            auto &buffer = *entry.second;
+            auto block = buffer.head_;
+            auto taken = buffer.head_taken_;
+            while (true) {
+                // next_ first, a block with a next is full
+                auto next = block->next_.load(std::memory_order_acquire);
+                auto size = block->size_.load(std::memory_order_acquire);
+                for (; taken < size; ++taken) {
+                    auto &click = block->clicks_[taken];
+                    ++sums[click.hash_];
+                    if (click.visitor_ != 0)
+                        visits.emplace_back(click.hash_, click.visitor_);
+                }
+                if (next == nullptr)
+                    break;
+                RecycleBlock(buffer, block);
+                block = next;
+                taken = 0;
+            }
+            buffer.head_ = block;
+            buffer.head_taken_ = taken;
+        }
+    }
+    clicks.assign(sums.begin(), sums.end());
+}
+
+} /* namespace sn */
@@ -0,0 +1,222 @@
+#include "click_series.h"
+#include "util/LoggerUtil.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <iterator>
+#include <unistd.h>
+
+namespace sn {
+
+static const char SERIES_MAGIC[8] = { 'S', 'N', 'S', 'E', 'R', 'I', 'E', 'S' };
+
+struct SeriesFileHeader {
+    char magic_[8];
+    std::uint32_t version_;
+    std::uint32_t reserved_;
+    std::uint64_t count_;
+};
+
+static void PutVarint(std::string &out, std::uint64_t value) {
+    while (value >= 0x80) {
+        out += static_cast<char>(value | 0x80);
+        value >>= 7;
+    }
+    out += static_cast<char>(value);
+}
+
+static bool GetVarint(std::string_view data, std::size_t &pos, std::uint64_t &value) {
+    value = 0;
+    for (int shift = 0; shift < 64 && pos < data.size(); shift += 7) {
+        auto byte = static_cast<std::uint8_t>(data[pos++]);
+        value |= std::uint64_t(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0)
+            return true;
+    }
+    return false;
+}
+
+void ClickSeries::Add(std::int64_t minute, std::uint64_t count) {
+    if (count == 0)
+        return;
+    if (last_count_ != 0 && minute <= last_minute_) {
+        last_count_ += count;
+        return;
+    }
+    if (last_count_ != 0) {
+        PutVarint(data_, last_minute_ - tail_minute_);
+        PutVarint(data_, last_count_);
+        tail_minute_ = last_minute_;
+    }
+    last_minute_ = minute;
+    last_count_ = count;
+    Trim(minute);
+}
+
+void ClickSeries::Trim(std::int64_t minute) {
+    auto first = minute - MINUTES + 1;
+    if (last_count_ != 0 && last_minute_ < first) {
+        std::string().swap(data_);
+        base_minute_ = tail_minute_ = last_minute_ = 0;
+        last_count_ = 0;
+        return;
+    }
+    std::size_t pos = 0, next = 0;
+    auto at = base_minute_;
+    std::uint64_t gap, count;
+    while (GetVarint(data_, next, gap) && GetVarint(data_, next, count) && at + std::int64_t(gap) < first) {
+        at += gap;
+        pos = next;
+    }
+    if (pos == 0)
+        return;
+    data_.erase(0, pos);
+    base_minute_ = at;
+    // most of the day gone, give the room back
+    if (data_.capacity() > 2 * data_.size() + 64)
+        data_.shrink_to_fit();
+}
+
+std::vector<std::uint64_t> ClickSeries::Counts(std::int64_t minute) const {
+    std::vector<std::uint64_t> counts(MINUTES, 0);
+    auto first = minute - MINUTES + 1;
+    auto add = [&](std::int64_t at, std::uint64_t count) {
+        if (at >= first && at <= minute)
+            counts[at - first] += count;
+    };
+    std::size_t pos = 0;
+    auto at = base_minute_;
+    std::uint64_t gap, count;
+    while (GetVarint(data_, pos, gap) && GetVarint(data_, pos, count)) {
+        at += gap;
+        add(at, count);
+    }
+    if (last_count_ != 0)
+        add(last_minute_, last_count_);
+    return counts;
+}
+
+void ClickSeries::Serialize(std::string &out) const {
+    PutVarint(out, base_minute_);
+    PutVarint(out, tail_minute_);
+    PutVarint(out, last_minute_);
+    PutVarint(out, last_count_);
+    out.append(data_);
+}
+
+bool ClickSeries::Deserialize(std::string_view data) {
+    std::size_t pos = 0;
+    std::uint64_t base, tail, last, last_count;
+    if (!GetVarint(data, pos, base) || !GetVarint(data, pos, tail) || !GetVarint(data, pos, last) ||
+            !GetVarint(data, pos, last_count) || base > tail || (last_count != 0 && last <= tail && pos < data.size()))
+        return false;
+    // the pairs have to add up to the tail with no click count of 0
+    auto pairs = data.substr(pos);
+    std::size_t at = 0;
+    std::uint64_t minute = base, gap, count;
+    while (at < pairs.size()) {
+        if (!GetVarint(pairs, at, gap) || !GetVarint(pairs, at, count) || count == 0)
+            return false;
+        minute += gap;
+    }
+    if (minute != tail || (last_count == 0 && !pairs.empty()))
+        return false;
+    data_.assign(pairs.data(), pairs.size());
+    base_minute_ = base;
+    tail_minute_ = tail;
+    last_minute_ = last;
+    last_count_ = last_count;
+    return true;
+}
+
+bool ClickSeries::WriteFile(const std::string &path, const std::vector<std::pair<HashKey, std::string>> &series) {
+    auto err = WriteFileQuiet(path, series);
+    if (err != 0)
+        LOGUTIL_LOG_E() << "write series " << path << " failed: " << std::strerror(err);
+    return err == 0;
+}
+
+int ClickSeries::WriteFileQuiet(const std::string &path, const std::vector<std::pair<HashKey, std::string>> &series) {
+    std::string buf;
+    SeriesFileHeader header;
+    std::memcpy(header.magic_, SERIES_MAGIC, sizeof(header.magic_));
+    header.version_ = FILE_VERSION;
+    header.reserved_ = 0;
+    header.count_ = series.size();
+    buf.append(reinterpret_cast<const char*>(&header), sizeof(header));
+    for (auto &link : series) {
+        std::uint32_t size = link.second.size();
+        buf.append(reinterpret_cast<const char*>(&link.first.hi_), sizeof(link.first.hi_));
+        buf.append(reinterpret_cast<const char*>(&link.first.lo_), sizeof(link.first.lo_));
+        buf += static_cast<char>(link.first.width_);
+        buf += static_cast<char>(link.first.alphabet_);
+        buf.append(reinterpret_cast<const char*>(&size), sizeof(size));
+        buf.append(link.second);
+    }
+    auto tmp_path = path + ".tmp";
+    auto fd = ::open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+        return errno;
+    int err = 0;
+    std::size_t done = 0;
+    while (done < buf.size()) {
+        auto ret = ::write(fd, buf.data() + done, buf.size() - done);
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret <= 0) {
+            err = ret < 0 ? errno : EIO;
+            break;
+        }
+        done += ret;
+    }
+    if (err == 0 && ::fdatasync(fd) != 0)
+        err = errno;
+    ::close(fd);
+    if (err == 0 && std::rename(tmp_path.c_str(), path.c_str()) != 0)
+        err = errno;
+    return err;
+}
+
+bool ClickSeries::ReadFile(const std::string &path, std::vector<std::pair<HashKey, std::string>> &series) {
+    series.clear();
+    std::ifstream fin(path, std::ios::binary);
+    if (!fin.is_open())
+        return false;
+    std::string buf((std::istreambuf_iterator<char>(fin)), std::istreambuf_iterator<char>());
+    SeriesFileHeader header;
+    if (buf.size() < sizeof(header))
+        return false;
+    std::memcpy(&header, buf.data(), sizeof(header));
+    if (std::memcmp(header.magic_, SERIES_MAGIC, sizeof(header.magic_)) != 0 || header.version_ != FILE_VERSION)
+        return false;
+    // hi, lo, the width and the alphabet byte of each hash
+    const std::size_t key_size = 18;
+    std::size_t pos = sizeof(header);
+    for (std::uint64_t i = 0; i < header.count_; ++i) {
+        std::uint64_t hi, lo;
+        std::uint32_t size;
+        if (buf.size() - pos < key_size + sizeof(size))
+            break;
+        std::memcpy(&hi, buf.data() + pos, sizeof(hi));
+        std::memcpy(&lo, buf.data() + pos + sizeof(hi), sizeof(lo));
+        std::memcpy(&size, buf.data() + pos + key_size, sizeof(size));
+        HashKey hash((static_cast<unsigned __int128>(hi) << 64) | lo, static_cast<std::uint8_t>(buf[pos + 16]),
+            static_cast<KeyAlphabet>(static_cast<std::uint8_t>(buf[pos + 17])));
+        pos += key_size + sizeof(size);
+        if (buf.size() - pos < size)
+            break;
+        series.emplace_back(hash, buf.substr(pos, size));
+        pos += size;
+    }
+    if (series.size() != header.count_ || pos != buf.size()) {
+        LOGUTIL_LOG_W() << "series " << path << " is corrupted, dropped";
+        series.clear();
+        return false;
+    }
+    return true;
+}
+
+} /* namespace sn */
@@ -3,11 +3,19 @@
 #include "Poco/Net/HTTPServerResponse.h"
 #include "util/JsonUtil.h"
 #include "Poco/JSON/Parser.h"
+#include "Poco/JSON/Array.h"
+#include "Poco/JSON/Object.h"
+#include "Poco/URI.h"
 
 #include "util/LoggerUtil.h"
 #include "util/StringUtil.h"
 #include "rc_common.h"
 #include "task.h"
+#include "hash_key.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
 
 #define LOG_REQ_INFO() LOGUTIL_LOG_D() << "proc req method:" << req.getMethod() << " uri:" << req.getURI() << "\n  - client:" \
                                 << req.clientAddress().toString() << " server:" << req.serverAddress().toString();
@@ -15,6 +23,13 @@
 using std::to_string;
 using std::string;
 
+// records an ndjson export reads and writes out at a time
+static constexpr std::size_t EXPORT_BATCH = 1024;
+// a hundred years, far from overflowing the expiry time
+static constexpr long TTL_MAX_SEC = 100L * 365 * 24 * 3600;
+// links /stats/top lists at most, well under what a bucket of HotLinks keeps
+static constexpr long TOP_LINKS_MAX = 100;
+
 
 static inline void QuickResponse(Poco::Net::HTTPServerResponse &res, int rc, const std::string &extra_data = "", bool log = true) {
     auto rc_str = to_string(rc);
@@ -27,6 +42,47 @@ static inline void QuickResponse(Poco::Net::HTTPServerResponse &res, int rc, con
     res.send() << sn::StringUtil::Format(R"({"code":%,"msg":"%"%%})", { rc_str, rc_msg, extra_head, extra_data });
 }
 
+// a parameter of the query of the request, empty if it is not there
+static std::string QueryParam(const Poco::Net::HTTPServerRequest &req, const std::string &name) {
+    for (auto &param : Poco::URI(req.getURI()).getQueryParameters()) {
+        if (param.first == name)
+            return param.second;
+    }
+    return "";
+}
+
+// seconds of a /stats/top window
+static bool ParseTopWindow(const std::string &name, std::int64_t &window_sec) {
+    if (name == "1m")
+        window_sec = 60;
+    else if (name == "5m")
+        window_sec = 5 * 60;
+    else if (name == "1h")
+        window_sec = 60 * 60;
+    else
+        return false;
+    return true;
+}
+
+// the body of a batch request, a json array or an object holding it under key
+static Poco::JSON::Array::Ptr LoadBatchArray(std::istream &in, const std::string &key) {
+    Poco::JSON::Parser parser;
+    auto json = parser.parse(in);
+    if (json.type() == typeid(Poco::JSON::Array::Ptr))
+        return json.extract<Poco::JSON::Array::Ptr>();
+    if (json.type() == typeid(Poco::JSON::Object::Ptr))
+        return json.extract<Poco::JSON::Object::Ptr>()->getArray(key);
+    return Poco::JSON::Array::Ptr();
+}
+
+// a spooled export to the client, false if it went away. copying an empty
+// file sets failbit on out, so an export of no records skips the copy
+static bool SendSpooled(std::istream &in, std::ostream &out) {
+    if (in.peek() != std::istream::traits_type::eof() && !(out << in.rdbuf()))
+        return false;
+    return static_cast<bool>(out.flush());
+}
+
 namespace sn {
 
 DEFINE_REQUEST_HANDLER(HdlShortUrlAdd) {
@@ -35,13 +91,62 @@ DEFINE_REQUEST_HANDLER(HdlShortUrlAdd) {
     auto json = JsonUtil::LoadJsonValue("", parser.parse(req.stream()));
     int rc    = ServerErrorCode::ALL_OK;
     auto url = json->GetString("url");
-    auto hash = inst_->mgr_->AddUrl(url);
+    // seconds the link lives, none or 0 for ever
+    auto ttl = json->GetInt("ttl", 0);
+    if (ttl < 0 || ttl > TTL_MAX_SEC) {
+        QuickResponse(res, ServerErrorCode::REQ_PARAMS_ERROR);
+        return;
+    }
+    bool logged = true;
+    auto hash = inst_->mgr_->AddUrl(url, ttl, &logged);
     if (hash.empty()) {
         QuickResponse(res, ServerErrorCode::REQ_JSON_ERROR);
         return;
     }
+    if (!logged) {
+        QuickResponse(res, ServerErrorCode::INTERNAL_STORAGE_ERROR);
+        return;
+    }
     QuickResponse(res, rc, JsonUtil::ToJsonString(hash));
 }
+DEFINE_REQUEST_HANDLER(HdlShortUrlAddBatch) {
+    // LOG_REQ_INFO();
+    // the urls straight from the parsed array, no JsonValue tree of them
+    auto arr = LoadBatchArray(req.stream(), "urls");
+    if (arr.isNull()) {
+        QuickResponse(res, ServerErrorCode::REQ_JSON_ERROR);
+        return;
+    }
+    if (arr->size() > static_cast<std::size_t>(inst_->add_batch_max_)) {
+        QuickResponse(res, ServerErrorCode::REQ_PARAMS_ERROR);
+        return;
+    }
+    std::vector<std::string> urls;
+    urls.reserve(arr->size());
+    for (std::size_t i = 0; i < arr->size(); ++i) {
+        auto val = arr->get(i);
+        if (!val.isString() || val.extract<std::string>().empty()) {
+            QuickResponse(res, ServerErrorCode::REQ_INVALID_URL);
+            return;
+        }
+        urls.push_back(val.extract<std::string>());
+    }
+    bool logged = true;
+    auto hashs = inst_->mgr_->AddUrls(urls, &logged);
+    if (!logged) {
+        QuickResponse(res, ServerErrorCode::INTERNAL_STORAGE_ERROR);
+        return;
+    }
+    // keys are plain alphabet chars, written out as they are without escaping
+    res.setContentType("application/json");
+    res.setStatus(Poco::Net::HTTPResponse::HTTPStatus::HTTP_OK);
+    auto &out = res.send();
+    out << StringUtil::Format(R"({"code":%,"msg":"%","data":[)",
+        { to_string(ServerErrorCode::ALL_OK), sn::ServerCodeToString(ServerErrorCode::ALL_OK) });
+    for (std::size_t i = 0; i < hashs.size(); ++i)
+        out << (i == 0 ? "\"" : ",\"") << hashs[i] << '"';
+    out << "]}";
+}
 DEFINE_REQUEST_HANDLER(HdlShortUrlDel) {
     // LOG_REQ_INFO();
     Poco::JSON::Parser parser;
@@ -53,7 +158,17 @@ DEFINE_REQUEST_HANDLER(HdlShortUrlDel) {
         QuickResponse(res, ServerErrorCode::REQ_JSON_ERROR);
         return;
     }
-    auto succ = hash.empty() ? inst_->mgr_->DelUrl(url) : inst_->mgr_->DelHash(hash);
+    HashKey key;
+    if (!hash.empty() && !HashKey::TryParse(hash, key, inst_->mgr_->GetKeyAlphabet())) {
+        QuickResponse(res, ServerErrorCode::REQ_INVALID_HASH);
+        return;
+    }
+    bool logged = true;
+    auto succ = hash.empty() ? inst_->mgr_->DelUrl(url, &logged) : inst_->mgr_->DelHash(key, &logged);
+    if (!logged) {
+        QuickResponse(res, ServerErrorCode::INTERNAL_STORAGE_ERROR);
+        return;
+    }
     QuickResponse(res, succ ? ServerErrorCode::ALL_OK : ServerErrorCode::REQ_JSON_ERROR);
 }
 DEFINE_REQUEST_HANDLER(HdlShortUrlGet) {
@@ -66,28 +181,202 @@ DEFINE_REQUEST_HANDLER(HdlShortUrlGet) {
         QuickResponse(res, ServerErrorCode::REQ_JSON_ERROR);
         return;
     }
-    auto url = inst_->mgr_->GetUrl(hash);
-    QuickResponse(res,
-        url.empty() ? ServerErrorCode::REQ_JSON_ERROR : ServerErrorCode::ALL_OK,
-        url.empty() ? "" : JsonUtil::ToJsonString(url));
+    HashKey key;
+    if (!HashKey::TryParse(hash, key, inst_->mgr_->GetKeyAlphabet())) {
+        QuickResponse(res, ServerErrorCode::REQ_INVALID_HASH);
+        return;
+    }
+    auto info = inst_->mgr_->GetUrlInfo(key);
+    if (info.url_.empty()) {
+        QuickResponse(res, ServerErrorCode::REQ_JSON_ERROR);
+        return;
+    }
+    // clicks next to data, which stays the url string
+    QuickResponse(res, ServerErrorCode::ALL_OK, JsonUtil::ToJsonString(info.url_) + R"(,"clicks":)" + to_string(info.clicks_));
+}
+DEFINE_REQUEST_HANDLER(HdlShortUrlGetBatch) {
+    // LOG_REQ_INFO();
+    auto arr = LoadBatchArray(req.stream(), "hashes");
+    if (arr.isNull()) {
+        QuickResponse(res, ServerErrorCode::REQ_JSON_ERROR);
+        return;
+    }
+    if (arr->size() > static_cast<std::size_t>(inst_->get_batch_max_)) {
+        QuickResponse(res, ServerErrorCode::REQ_PARAMS_ERROR);
+        return;
+    }
+    auto alphabet = inst_->mgr_->GetKeyAlphabet();
+    std::vector<HashKey> keys(arr->size());
+    for (std::size_t i = 0; i < arr->size(); ++i) {
+        auto val = arr->get(i);
+        if (!val.isString()) {
+            QuickResponse(res, ServerErrorCode::REQ_PARAMS_ERROR);
+            return;
+        }
+        // a hash that does not parse stays empty and comes back null like a miss
+        HashKey::TryParse(val.extract<std::string>(), keys[i], alphabet);
+    }
+    auto urls = inst_->mgr_->GetUrls(keys);
+    res.setContentType("application/json");
+    res.setStatus(Poco::Net::HTTPResponse::HTTPStatus::HTTP_OK);
+    auto &out = res.send();
+    out << StringUtil::Format(R"({"code":%,"msg":"%","data":[)",
+        { to_string(ServerErrorCode::ALL_OK), sn::ServerCodeToString(ServerErrorCode::ALL_OK) });
+    for (std::size_t i = 0; i < urls.size(); ++i) {
+        if (i != 0)
+            out << ',';
+        out << (urls[i].empty() ? "null" : JsonUtil::ToJsonString(urls[i]));
+    }
+    out << "]}";
+}
+DEFINE_REQUEST_HANDLER(HdlShortUrlExport) {
+    // LOG_REQ_INFO();
+    auto format = ctx_.keys_.empty() ? std::string("ndjson") : ctx_.keys_.front();
+    if (format != "ndjson" && format != "snap") {
+        QuickResponse(res, ServerErrorCode::REQ_PARAMS_ERROR);
+        return;
+    }
+    if (format == "snap") {
+        // the snapshot index is sorted over all records, so it goes to a file
+        // first and a slow client only holds that file
+        std::ifstream in;
+        if (!inst_->mgr_->ExportSnapshot(in)) {
+            QuickResponse(res, ServerErrorCode::INTERNAL_UNKNOWN_ERROR);
+            return;
+        }
+        res.setChunkedTransferEncoding(true);
+        res.setStatus(Poco::Net::HTTPResponse::HTTPStatus::HTTP_OK);
+        res.setContentType("application/octet-stream");
+        if (!SendSpooled(in, res.send()))
+            LOGUTIL_LOG_W() << "export snapshot to " << req.clientAddress().toString() << " broken off";
+        return;
+    }
+    // straight to the client a batch at a time, nothing is frozen or held between
+    // batches, so a slow client only slows itself. one that goes away ends it
+    auto stream = inst_->mgr_->StreamRecords();
+    res.setChunkedTransferEncoding(true);
+    res.setStatus(Poco::Net::HTTPResponse::HTTPStatus::HTTP_OK);
+    res.setContentType("application/x-ndjson");
+    auto &out = res.send();
+    std::vector<ShortUrlInfo> infos;
+    std::string lines;
+    while (out && stream.Next(EXPORT_BATCH, infos)) {
+        lines.clear();
+        for (auto &info : infos) {
+            lines += R"({"hash":")";
+            lines += info.hash_.ToString();
+            lines += R"(","url":)";
+            lines += JsonUtil::ToJsonString(info.url_);
+            lines += R"(,"expire_at":)";
+            lines += to_string(info.expire_at_);
+            lines += "}\n";
+        }
+        out << lines;
+        infos.clear();
+    }
+    if (!out.flush())
+        LOGUTIL_LOG_W() << "export to " << req.clientAddress().toString() << " broken off";
 }
 DEFINE_REQUEST_HANDLER(HdlShortUrlJump) {
     // LOG_REQ_INFO();
     int rc = ServerErrorCode::ALL_OK;
-    if (ctx_.keys_.empty() || ctx_.keys_.front().empty()) {
+    HashKey key;
+    // chars outside the alphabet never reach a lookup
+    if (ctx_.keys_.empty() || !HashKey::TryParse(ctx_.keys_.front(), key, inst_->mgr_->GetKeyAlphabet())) {
         res.setStatus(Poco::Net::HTTPResponse::HTTPStatus::HTTP_NOT_FOUND);
         res.send() << R"(<html><body>404 Not Found</body></html>)";
         return;
     }
-    auto &hash = ctx_.keys_.front();
-    auto url = inst_->mgr_->GetUrl(hash);
+    auto url = inst_->mgr_->GetUrl(key);
     if (url.empty()) {
         res.setStatus(Poco::Net::HTTPResponse::HTTPStatus::HTTP_NOT_FOUND);
         res.send() << R"(<html><body>404 Not Found</body></html>)";
         return;
     }
+    // only the address is hashed here, the visitor is counted off this thread with the click
+    std::uint64_t visitor = 0;
+    if (inst_->unique_visitors_)
+        visitor = UrlHasher()(req.clientAddress().host().toString());
+    inst_->mgr_->CountClick(key, visitor);
     res.redirect(url);
 }
+DEFINE_REQUEST_HANDLER(HdlShortUrlVisitors) {
+    auto hash = QueryParam(req, "hash");
+    if (hash.empty()) {
+        QuickResponse(res, ServerErrorCode::REQ_PARAMS_ERROR);
+        return;
+    }
+    HashKey key;
+    if (!HashKey::TryParse(hash, key, inst_->mgr_->GetKeyAlphabet())) {
+        QuickResponse(res, ServerErrorCode::REQ_INVALID_HASH);
+        return;
+    }
+    auto info = inst_->mgr_->GetUrlInfo(key);
+    std::uint64_t visitors = 0;
+    if (info.url_.empty() || !inst_->mgr_->GetVisitors(key, visitors)) {
+        QuickResponse(res, ServerErrorCode::REQ_JSON_ERROR);
+        return;
+    }
+    QuickResponse(res, ServerErrorCode::ALL_OK, StringUtil::Format(R"({"hash":%,"clicks":%,"visitors":%})",
+        { JsonUtil::ToJsonString(hash), to_string(info.clicks_), to_string(visitors) }));
+}
+DEFINE_REQUEST_HANDLER(HdlShortUrlTop) {
+    auto window = QueryParam(req, "window");
+    auto k_str = QueryParam(req, "k");
+    if (window.empty())
+        window = "1m";
+    std::int64_t window_sec = 0;
+    char *end = nullptr;
+    long k = k_str.empty() ? 10 : std::strtol(k_str.c_str(), &end, 10);
+    if (!ParseTopWindow(window, window_sec) || (end != nullptr && *end != '\0') || k < 1 || k > TOP_LINKS_MAX) {
+        QuickResponse(res, ServerErrorCode::REQ_PARAMS_ERROR);
+        return;
+    }
+    // links deleted since are left out, the next ones fill in
+    auto top = inst_->mgr_->GetTopLinks(window_sec, HotLinks::CAPACITY);
+    std::string links;
+    long count = 0;
+    for (auto &entry : top) {
+        if (count >= k)
+            break;
+        auto url = inst_->mgr_->GetUrl(entry.hash_);
+        if (url.empty())
+            continue;
+        links += StringUtil::Format(R"(%{"hash":%,"url":%,"clicks":%,"error":%})", { count == 0 ? "" : ",",
+            JsonUtil::ToJsonString(entry.hash_.ToString()), JsonUtil::ToJsonString(url),
+            to_string(entry.count_), to_string(entry.error_) });
+        ++count;
+    }
+    QuickResponse(res, ServerErrorCode::ALL_OK, StringUtil::Format(R"({"window":%,"links":[%]})",
+        { JsonUtil::ToJsonString(window), links }));
+}
+DEFINE_REQUEST_HANDLER(HdlShortUrlSeries) {
+    auto hash = QueryParam(req, "hash");
+    if (hash.empty() || !inst_->click_series_) {
+        QuickResponse(res, ServerErrorCode::REQ_PARAMS_ERROR);
+        return;
+    }
+    HashKey key;
+    if (!HashKey::TryParse(hash, key, inst_->mgr_->GetKeyAlphabet())) {
+        QuickResponse(res, ServerErrorCode::REQ_INVALID_HASH);
+        return;
+    }
+    std::int64_t start = 0;
+    std::vector<std::uint64_t> counts;
+    if (!inst_->mgr_->GetClickSeries(key, start, counts)) {
+        QuickResponse(res, ServerErrorCode::REQ_JSON_ERROR);
+        return;
+    }
+    std::string clicks;
+    clicks.reserve(counts.size() * 2);
+    for (std::size_t i = 0; i < counts.size(); ++i) {
+        if (i > 0)
+            clicks += ',';
+        clicks += to_string(counts[i]);
+    }
+    QuickResponse(res, ServerErrorCode::ALL_OK, StringUtil::Format(R"({"hash":%,"start":%,"step":60,"clicks":[%]})",
+        { JsonUtil::ToJsonString(hash), to_string(start), clicks }));
+}
 DEFINE_REQUEST_HANDLER(HdlShortUrlWebpage) {
     res.setContentType("text/html");
     res.setStatus(Poco::Net::HTTPResponse::HTTPStatus::HTTP_OK);
@@ -110,7 +399,22 @@ DEFINE_REQUEST_HANDLER(HdlShortUrlStatic) {
 }
 
 DEFINE_REQUEST_HANDLER(HdlShortUrlInfo) {
-    QuickResponse(res, ServerErrorCode::ALL_OK, "", false);
+    auto mgr = inst_->mgr_;
+    auto forecast = mgr->ForecastHashWidth();
+    char occupancy[32], probe_mean[32], next_at[48], next_in[48], next_eta[48];
+    std::snprintf(occupancy, sizeof(occupancy), "%.6g", mgr->GetOccupancyRatio());
+    std::snprintf(probe_mean, sizeof(probe_mean), "%.3f", forecast.probe_mean_);
+    // all -1 when the width does not grow any more
+    std::snprintf(next_at, sizeof(next_at), "%.0f", forecast.escalate_at_);
+    std::snprintf(next_in, sizeof(next_in), "%.0f", forecast.escalate_at_ < 0 ? -1. :
+        std::max(forecast.escalate_at_ - forecast.taken_, 0.));
+    std::snprintf(next_eta, sizeof(next_eta), "%.0f", forecast.eta_sec_);
+    auto info = StringUtil::Format(R"({"records":%,"alphabet":"%","hash_width":%,"occupancy":%,"probe_mean":%,)"
+        R"("next_width_at":%,"next_width_in":%,"next_width_eta_s":%})",
+        { to_string(mgr->GetRecordCount()), KeyAlphabetName(mgr->GetKeyAlphabet()), to_string(mgr->GetHashWidth()),
+          occupancy, probe_mean,
+          next_at, next_in, next_eta });
+    QuickResponse(res, ServerErrorCode::ALL_OK, info, false);
 }
 
 } /* namespace sn */
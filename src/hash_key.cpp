@@ -0,0 +1,184 @@
+#include "hash_key.h"
+
+namespace sn {
+
+// radix^CHUNK_WIDTH fits in 64 bits for every alphabet, so keys of other
+// alphabets go through at most two chunks with 64 bit arithmetic
+static constexpr int CHUNK_WIDTH = 10;
+
+namespace {
+
+struct AlphabetTable {
+    const char *name_;
+    const char *chars_;
+    int radix_;
+    int max_width_;
+    std::uint64_t chunk_space_;
+    // digit of each char, -1 outside the alphabet
+    std::int8_t digits_[256];
+};
+
+constexpr AlphabetTable MakeAlphabetTable(const char *name, const char *chars, int radix, int max_width) {
+    AlphabetTable table{ name, chars, radix, max_width, 1, {} };
+    for (int i = 0; i < CHUNK_WIDTH; ++i)
+        table.chunk_space_ *= radix;
+    for (auto &digit : table.digits_)
+        digit = -1;
+    for (int i = 0; i < radix; ++i)
+        table.digits_[static_cast<unsigned char>(chars[i])] = i;
+    return table;
+}
+
+// indexed by KeyAlphabet
+constexpr AlphabetTable ALPHABETS[] = {
+    MakeAlphabetTable("hex", "0123456789abcdef", 16, HashKey::MAX_WIDTH),
+    MakeAlphabetTable("base62", "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz", 62, 20),
+    MakeAlphabetTable("base58", "123456789ABCDEFGHJKLMNPQRSTUVWXYZabcdefghijkmnopqrstuvwxyz", 58, 20),
+};
+
+} /* namespace */
+
+// a constant radix turns the divisions into multiplications
+template <std::uint64_t RADIX>
+static inline void EncodeChunk(const char *chars, std::uint64_t part, char *end, int n) {
+    for (int i = 1; i <= n; ++i) {
+        end[-i] = chars[part % RADIX];
+        part /= RADIX;
+    }
+}
+
+static inline void EncodeChunk(const AlphabetTable &table, std::uint64_t part, char *end, int n) {
+    if (table.radix_ == 62)
+        EncodeChunk<62>(table.chars_, part, end, n);
+    else
+        EncodeChunk<58>(table.chars_, part, end, n);
+}
+
+static inline bool DecodeChunk(const AlphabetTable &table, const char *str, int n, std::uint64_t &part) {
+    part = 0;
+    for (int i = 0; i < n; ++i) {
+        auto digit = table.digits_[static_cast<unsigned char>(str[i])];
+        if (digit < 0)
+            return false;
+        part = part * table.radix_ + digit;
+    }
+    return true;
+}
+
+bool ParseKeyAlphabet(const std::string &name, KeyAlphabet &alphabet) {
+    for (int i = 0; i < static_cast<int>(sizeof(ALPHABETS) / sizeof(ALPHABETS[0])); ++i) {
+        if (name == ALPHABETS[i].name_) {
+            alphabet = static_cast<KeyAlphabet>(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+const char* KeyAlphabetName(KeyAlphabet alphabet) {
+    return ALPHABETS[alphabet].name_;
+}
+
+std::string HashKey::ToString() const {
+    auto &table = ALPHABETS[Alphabet()];
+    auto width = Width();
+    auto val = Value();
+    std::string ret(width, '0');
+    if (Alphabet() == KEY_ALPHABET_HEX) {
+        for (int i = width - 1; i >= 0; --i) {
+            ret[i] = table.chars_[static_cast<int>(val & 0xF)];
+            val >>= 4;
+        }
+        return ret;
+    }
+    auto end = &ret[0] + width;
+    if (width <= CHUNK_WIDTH) {
+        EncodeChunk(table, static_cast<std::uint64_t>(val), end, width);
+    } else {
+        EncodeChunk(table, static_cast<std::uint64_t>(val % table.chunk_space_), end, CHUNK_WIDTH);
+        EncodeChunk(table, static_cast<std::uint64_t>(val / table.chunk_space_), end - CHUNK_WIDTH, width - CHUNK_WIDTH);
+    }
+    return ret;
+}
+
+bool HashKey::IsSpelledHex() const {
+    if (Alphabet() == KEY_ALPHABET_HEX)
+        return false;
+    for (auto ch : ToString()) {
+        if (ALPHABETS[KEY_ALPHABET_HEX].digits_[static_cast<unsigned char>(ch)] < 0)
+            return false;
+    }
+    return true;
+}
+
+bool HashKey::TryParse(const std::string &str, HashKey &key, KeyAlphabet alphabet) {
+    if (str.empty())
+        return false;
+    auto &hex = ALPHABETS[KEY_ALPHABET_HEX];
+    bool is_hex = true;
+    for (auto ch : str) {
+        if (hex.digits_[static_cast<unsigned char>(ch)] < 0) {
+            is_hex = false;
+            break;
+        }
+    }
+    if (is_hex) {
+        if (str.size() > MAX_WIDTH)
+            return false;
+        unsigned __int128 val = 0;
+        for (auto ch : str)
+            val = (val << 4) | hex.digits_[static_cast<unsigned char>(ch)];
+        key = HashKey(val, str.size());
+        return true;
+    }
+    auto &table = ALPHABETS[alphabet];
+    int width = str.size();
+    if (alphabet == KEY_ALPHABET_HEX || width > table.max_width_)
+        return false;
+    int head = width > CHUNK_WIDTH ? width - CHUNK_WIDTH : 0;
+    std::uint64_t hi, lo;
+    if (!DecodeChunk(table, str.data(), head, hi) || !DecodeChunk(table, str.data() + head, width - head, lo))
+        return false;
+    key = HashKey(static_cast<unsigned __int128>(hi) * table.chunk_space_ + lo, width, alphabet);
+    return true;
+}
+
+HashKey HashKey::Parse(const std::string &str, KeyAlphabet alphabet) {
+    HashKey ret;
+    TryParse(str, ret, alphabet);
+    return ret;
+}
+
+HashKey HashKey::FromDigest(const unsigned char *digest, int width, KeyAlphabet alphabet) {
+    unsigned __int128 val = 0;
+    for (int i = 0; i < 16; ++i)
+        val = (val << 8) | digest[i];
+    if (alphabet == KEY_ALPHABET_HEX)
+        return HashKey(val >> (128 - width * 4), width);
+    // the leading bits scaled into the space, or the remainder once the space passes 64 bits
+    auto space = Space(alphabet, width);
+    if ((space >> 64) == 0)
+        return HashKey(((val >> 64) * space) >> 64, width, alphabet);
+    return HashKey(val % space, width, alphabet);
+}
+
+int HashKey::Radix(KeyAlphabet alphabet) {
+    return ALPHABETS[alphabet].radix_;
+}
+
+int HashKey::MaxWidth(KeyAlphabet alphabet) {
+    return ALPHABETS[alphabet].max_width_;
+}
+
+unsigned __int128 HashKey::Space(KeyAlphabet alphabet, int width) {
+    unsigned __int128 space = 1;
+    for (int i = 0; i < width; ++i) {
+        // only 32 hex digits get past 128 bits
+        if (space > ~static_cast<unsigned __int128>(0) / ALPHABETS[alphabet].radix_)
+            return ~static_cast<unsigned __int128>(0);
+        space *= ALPHABETS[alphabet].radix_;
+    }
+    return space;
+}
+
+} /* namespace sn */
@@ -0,0 +1,129 @@
+#include "hot_links.h"
+
+#include <algorithm>
+
+namespace sn {
+
+std::uint64_t HotLinks::Sketch::Add(const HashKey &hash, std::uint64_t count) {
+    // the rows index by double hashing of one 64 bits hash
+    std::uint64_t h = HashKeyHasher()(hash);
+    std::uint64_t a = h & 0xffffffff, b = (h >> 32) | 1;
+    std::size_t idx[SKETCH_DEPTH];
+    std::uint64_t estimate = UINT64_MAX;
+    for (int row = 0; row < SKETCH_DEPTH; ++row) {
+        idx[row] = row * SKETCH_WIDTH + ((a + row * b) & (SKETCH_WIDTH - 1));
+        estimate = std::min(estimate, counts_[idx[row]]);
+    }
+    estimate += count;
+    for (int row = 0; row < SKETCH_DEPTH; ++row)
+        counts_[idx[row]] = std::max(counts_[idx[row]], estimate);
+    return estimate;
+}
+
+void HotLinks::Summary::Swap(std::size_t i, std::size_t j) {
+    std::swap(heap_[i], heap_[j]);
+    pos_[heap_[i].hash_] = i;
+    pos_[heap_[j].hash_] = j;
+}
+
+void HotLinks::Summary::SiftDown(std::size_t i) {
+    while (true) {
+        auto smallest = i;
+        for (auto child : { 2 * i + 1, 2 * i + 2 }) {
+            if (child < heap_.size() && heap_[child].count_ < heap_[smallest].count_)
+                smallest = child;
+        }
+        if (smallest == i)
+            return;
+        Swap(i, smallest);
+        i = smallest;
+    }
+}
+
+void HotLinks::Summary::Add(const HashKey &hash, std::uint64_t count, std::uint64_t estimate) {
+    auto it = pos_.find(hash);
+    if (it != pos_.end()) {
+        heap_[it->second].count_ += count;
+        SiftDown(it->second);
+        return;
+    }
+    // what the sketch has of it before count may be collisions only
+    Entry entry{ hash, estimate, estimate - count };
+    if (!IsFull()) {
+        heap_.push_back(entry);
+        pos_[hash] = heap_.size() - 1;
+        for (auto i = heap_.size() - 1; i > 0 && heap_[(i - 1) / 2].count_ > heap_[i].count_; i = (i - 1) / 2)
+            Swap(i, (i - 1) / 2);
+        return;
+    }
+    if (estimate <= heap_.front().count_)
+        return;
+    pos_.erase(heap_.front().hash_);
+    heap_.front() = entry;
+    pos_[hash] = 0;
+    SiftDown(0);
+}
+
+HotLinks::HotLinks(std::int64_t now) : current_(now / BUCKET_SEC), buckets_(BUCKETS) {}
+
+void HotLinks::Add(std::int64_t now, const std::vector<std::pair<HashKey, std::uint64_t>> &clicks) {
+    auto number = now / BUCKET_SEC;
+    if (number > current_) {
+        auto &bucket = buckets_[current_ % BUCKETS];
+        bucket.number_ = current_;
+        bucket.full_ = live_.IsFull();
+        bucket.min_count_ = live_.MinCount();
+        bucket.entries_ = live_.Entries();
+        live_.Clear();
+        sketch_.Clear();
+        current_ = number;
+    }
+    for (auto &click : clicks)
+        live_.Add(click.first, click.second, sketch_.Add(click.first, click.second));
+}
+
+std::vector<HotLinks::Entry> HotLinks::Top(std::int64_t now, std::int64_t window_sec, std::size_t k) const {
+    auto last = now / BUCKET_SEC;
+    auto first = last - std::max<std::int64_t>(1, (window_sec + BUCKET_SEC - 1) / BUCKET_SEC) + 1;
+    // a link missing in a full bucket may have had up to its minimum there
+    struct Sum {
+        std::uint64_t count_ = 0;
+        std::uint64_t error_ = 0;
+        std::uint64_t missed_ = 0;
+    };
+    std::unordered_map<HashKey, Sum, HashKeyHasher> sums;
+    std::uint64_t missed_total = 0;
+    auto add = [&](const std::vector<Entry> &entries, bool full, std::uint64_t min_count) {
+        for (auto &entry : entries) {
+            auto &sum = sums[entry.hash_];
+            sum.count_ += entry.count_;
+            sum.error_ += entry.error_;
+            if (full)
+                sum.missed_ += min_count;
+        }
+        if (full)
+            missed_total += min_count;
+    };
+    if (current_ >= first && current_ <= last)
+        add(live_.Entries(), live_.IsFull(), live_.MinCount());
+    for (auto &bucket : buckets_) {
+        if (bucket.number_ >= first && bucket.number_ <= last && bucket.number_ != current_)
+            add(bucket.entries_, bucket.full_, bucket.min_count_);
+    }
+    std::vector<Entry> top;
+    top.reserve(sums.size());
+    for (auto &sum : sums)
+        top.push_back(Entry{ sum.first, sum.second.count_, sum.second.error_ + missed_total - sum.second.missed_ });
+    auto by_count = [](const Entry &lhs, const Entry &rhs) {
+        return lhs.count_ != rhs.count_ ? lhs.count_ > rhs.count_ : lhs.hash_ < rhs.hash_;
+    };
+    if (top.size() > k) {
+        std::partial_sort(top.begin(), top.begin() + k, top.end(), by_count);
+        top.resize(k);
+    } else {
+        std::sort(top.begin(), top.end(), by_count);
+    }
+    return top;
+}
+
+} /* namespace sn */
@@ -0,0 +1,167 @@
+#include "hyperloglog.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace sn {
+
+// registers are little endian bit fields, one spans two bytes at most
+static inline int ReadRegister(const std::uint8_t *dense, std::size_t index) {
+    auto bit = index * 6;
+    unsigned word = dense[bit / 8];
+    if (bit % 8 > 2)
+        word |= unsigned(dense[bit / 8 + 1]) << 8;
+    return (word >> (bit % 8)) & 0x3f;
+}
+
+int HyperLogLog::Get(std::size_t index) const {
+    return ReadRegister(dense_.data(), index);
+}
+
+void HyperLogLog::Set(std::size_t index, int rank) {
+    auto bit = index * 6;
+    unsigned word = dense_[bit / 8];
+    if (bit % 8 > 2)
+        word |= unsigned(dense_[bit / 8 + 1]) << 8;
+    word = (word & ~(0x3fu << (bit % 8))) | unsigned(rank) << (bit % 8);
+    dense_[bit / 8] = word & 0xff;
+    if (bit % 8 > 2)
+        dense_[bit / 8 + 1] = word >> 8;
+}
+
+void HyperLogLog::Update(std::size_t index, int rank) {
+    if (!IsSparse()) {
+        if (rank > Get(index))
+            Set(index, rank);
+        return;
+    }
+    std::uint32_t entry = std::uint32_t(index) << 8 | std::uint32_t(rank);
+    auto it = std::lower_bound(sparse_.begin(), sparse_.end(), std::uint32_t(index) << 8);
+    if (it != sparse_.end() && (*it >> 8) == index) {
+        *it = std::max(*it, entry);
+        return;
+    }
+    sparse_.insert(it, entry);
+    if (sparse_.size() > SPARSE_MAX)
+        ToDense();
+}
+
+void HyperLogLog::ToDense() {
+    dense_.assign(DENSE_BYTES, 0);
+    for (auto entry : sparse_)
+        Set(entry >> 8, entry & 0xff);
+    std::vector<std::uint32_t>().swap(sparse_);
+}
+
+void HyperLogLog::Add(std::uint64_t hash) {
+    std::size_t index = hash >> (64 - PRECISION);
+    // the rank of the rest is its leading zeros plus one, a guard bit caps it
+    auto rest = hash << PRECISION | std::uint64_t(1) << (PRECISION - 1);
+    Update(index, __builtin_clzll(rest) + 1);
+}
+
+void HyperLogLog::Merge(const HyperLogLog &other) {
+    if (other.IsSparse()) {
+        for (auto entry : other.sparse_)
+            Update(entry >> 8, entry & 0xff);
+        return;
+    }
+    if (IsSparse())
+        ToDense();
+    for (std::size_t i = 0; i < REGISTERS; ++i)
+        Update(i, other.Get(i));
+}
+
+// the series of Ertl's improved estimator, "New cardinality estimation
+// algorithms for HyperLogLog sketches", both run until they stop changing
+static double Sigma(double x) {
+    double y = 1, z = x, last;
+    do {
+        x *= x;
+        last = z;
+        z += x * y;
+        y += y;
+    } while (z != last);
+    return z;
+}
+
+static double Tau(double x) {
+    if (x == 0 || x == 1)
+        return 0;
+    double y = 1, z = 1 - x, last;
+    do {
+        x = std::sqrt(x);
+        last = z;
+        y *= 0.5;
+        z -= (1 - x) * (1 - x) * y;
+    } while (z != last);
+    return z / 3;
+}
+
+// from the histogram of the register ranks, no bias tables and no switch
+// over to linear counting needed
+std::uint64_t HyperLogLog::Estimate() const {
+    const double m = REGISTERS;
+    std::size_t counts[MAX_RANK + 1] = {};
+    if (IsSparse()) {
+        counts[0] = REGISTERS - sparse_.size();
+        for (auto entry : sparse_)
+            ++counts[entry & 0xff];
+    } else {
+        for (std::size_t i = 0; i < REGISTERS; ++i)
+            ++counts[Get(i)];
+    }
+    if (counts[0] == REGISTERS)
+        return 0;
+    double z = m * Tau(1 - counts[MAX_RANK] / m);
+    for (int rank = MAX_RANK - 1; rank >= 1; --rank)
+        z = 0.5 * (z + counts[rank]);
+    z += m * Sigma(counts[0] / m);
+    return static_cast<std::uint64_t>(m * m / (2 * std::log(2.0)) / z + 0.5);
+}
+
+void HyperLogLog::Serialize(std::string &out) const {
+    if (IsSparse()) {
+        out.push_back(char(FORMAT_SPARSE));
+        auto pos = out.size();
+        out.resize(pos + sparse_.size() * sizeof(std::uint32_t));
+        std::memcpy(&out[pos], sparse_.data(), sparse_.size() * sizeof(std::uint32_t));
+    } else {
+        out.push_back(char(FORMAT_DENSE));
+        out.append(reinterpret_cast<const char*>(dense_.data()), dense_.size());
+    }
+}
+
+bool HyperLogLog::Deserialize(std::string_view data) {
+    if (data.empty())
+        return false;
+    auto format = static_cast<std::uint8_t>(data[0]);
+    data.remove_prefix(1);
+    if (format == FORMAT_DENSE && data.size() == DENSE_BYTES) {
+        // a rank past MAX_RANK would count outside the histogram of Estimate
+        auto dense = reinterpret_cast<const std::uint8_t*>(data.data());
+        for (std::size_t i = 0; i < REGISTERS; ++i) {
+            if (ReadRegister(dense, i) > MAX_RANK)
+                return false;
+        }
+        std::vector<std::uint32_t>().swap(sparse_);
+        dense_.assign(data.begin(), data.end());
+        return true;
+    }
+    if (format != FORMAT_SPARSE || data.size() % sizeof(std::uint32_t) != 0 ||
+            data.size() / sizeof(std::uint32_t) > SPARSE_MAX)
+        return false;
+    std::vector<std::uint32_t> sparse(data.size() / sizeof(std::uint32_t));
+    std::memcpy(sparse.data(), data.data(), data.size());
+    for (std::size_t i = 0; i < sparse.size(); ++i) {
+        if ((sparse[i] >> 8) >= REGISTERS || (sparse[i] & 0xff) == 0 || (sparse[i] & 0xff) > MAX_RANK ||
+                (i > 0 && (sparse[i - 1] >> 8) >= (sparse[i] >> 8)))
+            return false;
+    }
+    std::vector<std::uint8_t>().swap(dense_);
+    sparse_.swap(sparse);
+    return true;
+}
+
+} /* namespace sn */
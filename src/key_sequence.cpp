@@ -0,0 +1,62 @@
+#include "key_sequence.h"
+#include "util/md5.h"
+
+#include <cstring>
+
+namespace sn {
+
+static inline std::uint64_t Mix(std::uint64_t h) {
+    h ^= h >> 30;
+    h *= 0xBF58476D1CE4E5B9ull;
+    h ^= h >> 27;
+    h *= 0x94D049BB133111EBull;
+    h ^= h >> 31;
+    return h;
+}
+
+bool ParseHashMode(const std::string &name, HashMode &mode) {
+    if (name == "md5")
+        mode = HASH_MODE_MD5;
+    else if (name == "sequence")
+        mode = HASH_MODE_SEQUENCE;
+    else
+        return false;
+    return true;
+}
+
+KeyPermutation::KeyPermutation(const std::string &secret) {
+    // the round keys have to stay the same across restarts, std::hash may not
+    md5::MD5 hash(secret);
+    std::uint64_t seed[2];
+    std::memcpy(seed, hash.digest(), sizeof(seed));
+    for (int i = 0; i < ROUNDS; ++i)
+        keys_[i] = Mix(seed[i & 1] + (i + 1) * 0x9E3779B97F4A7C15ull);
+}
+
+HashKey KeyPermutation::Permute(std::uint64_t num, int width, KeyAlphabet alphabet) const {
+    auto space = Space(width, alphabet);
+    int half = 1;
+    while ((std::uint64_t(1) << (2 * half)) < space)
+        ++half;
+    // the network covers the smallest even power of two over the space, hex
+    // exactly. values past the space walk on until they land in it, under 4
+    // steps on average, which keeps it a permutation of the space
+    do {
+        num = Feistel(num, half);
+    } while (num >= space);
+    return HashKey(num, width, alphabet);
+}
+
+std::uint64_t KeyPermutation::Feistel(std::uint64_t num, int half) const {
+    std::uint64_t mask = (std::uint64_t(1) << half) - 1;
+    std::uint64_t left = num >> half;
+    std::uint64_t right = num & mask;
+    for (int i = 0; i < ROUNDS; ++i) {
+        auto next = left ^ (Mix(right ^ keys_[i]) & mask);
+        left = right;
+        right = next;
+    }
+    return (left << half) | right;
+}
+
+} /* namespace sn */
@@ -4,6 +4,7 @@
 #include "util/FileUtil.h"
 #include "route.h"
 #include "handler.h"
+#include "rcu.h"
 
 #include "Poco/Net/HTTPServerParams.h"
 #include "util/LoggerUtil.h"
@@ -27,20 +28,9 @@ struct CustomConnectionFilter : public Poco::Net::TCPServerConnectionFilter {
 int main(int argc, char *argv[])
 {
     ShortUrlMgr mgr;
-    sn::ServerConfig cfg{
-        .data_path_ = "data/",
-        .webpage_html_ = FileUtil::LoadFile("webpage.html"),
-        .save_internal_ = 60,
-        .save_async_ = false,
-        .hash_width_ = 6,
-        .mgr_ = &mgr,
-    };
+    auto cfg = sn::DefaultServerConfig(&mgr);
+    cfg.webpage_html_ = FileUtil::LoadFile("webpage.html");
     {
-        cfg.log_path_ = "log/";
-        cfg.bind_ip_ = "::1";
-        cfg.max_num_ = -1;
-        cfg.port_ = 8080;
-
         auto cfg_map = ConfigUtil::ConfigMap("short-url-server.ini");
         cfg_map.TryReadConfig(cfg.log_path_, "log_path");
         cfg_map.TryReadConfig(cfg.bind_ip_, "bind_ip");
@@ -50,20 +40,55 @@ int main(int argc, char *argv[])
         cfg_map.TryReadConfig(cfg.data_path_, "data_path");
         // cfg_map.TryReadConfig(cfg.webpage_html_, "webpage_html_filename");
         cfg_map.TryReadConfig(cfg.save_internal_, "save_internal");
+        cfg_map.TryReadConfig(cfg.click_save_internal_, "click_save_internal");
         cfg_map.TryReadConfig(cfg.save_async_, "save_async");
+        cfg_map.TryReadConfig(cfg.save_fork_, "save_fork");
+        cfg_map.TryReadConfig(cfg.wal_fsync_, "wal_fsync");
+        cfg_map.TryReadConfig(cfg.wal_fsync_ms_, "wal_fsync_ms");
+        cfg_map.TryReadConfig(cfg.key_alphabet_, "key_alphabet");
         cfg_map.TryReadConfig(cfg.hash_width_, "hash_width");
+        cfg_map.TryReadConfig(cfg.hash_width_max_, "hash_width_max");
+        cfg_map.TryReadConfig(cfg.hash_probe_budget_, "hash_probe_budget");
+        cfg_map.TryReadConfig(cfg.hash_mode_, "hash_mode");
+        cfg_map.TryReadConfig(cfg.hash_func_, "hash_func");
+        cfg_map.TryReadConfig(cfg.sequence_secret_, "sequence_secret");
+        cfg_map.TryReadConfig(cfg.shard_num_, "shard_num");
+        cfg_map.TryReadConfig(cfg.load_threads_, "load_threads");
+        cfg_map.TryReadConfig(cfg.add_batch_max_, "add_batch_max");
+        cfg_map.TryReadConfig(cfg.get_batch_max_, "get_batch_max");
+        cfg_map.TryReadConfig(cfg.unique_visitors_, "unique_visitors");
+        cfg_map.TryReadConfig(cfg.click_series_, "click_series");
     }
 
     LoggerUtil::InitLogRotation(argv[0], cfg.log_path_);
+    ApplyKeyConfig(mgr, cfg);
+    mgr.SetClickSeries(cfg.click_series_);
     mgr.LoadRecords(cfg.data_path_);
-    mgr.SaveRecordsSync(cfg.data_path_);
-    mgr.SetHashWidth(cfg.hash_width_);
+    WalFsyncPolicy wal_policy;
+    if (!ParseWalFsyncPolicy(cfg.wal_fsync_, wal_policy)) {
+        LOGUTIL_LOG_W() << "unknown wal_fsync " << cfg.wal_fsync_ << ", use interval";
+        wal_policy = WAL_FSYNC_INTERVAL;
+    }
+    if (!mgr.OpenWal(cfg.data_path_, wal_policy, cfg.wal_fsync_ms_)) {
+        LOGUTIL_LOG_E() << "open wal in " << cfg.data_path_ << " failed";
+        return 1;
+    }
+    // a mapped snapshot is saved again by the periodic save once it is built
+    if (!mgr.IsLoading())
+        mgr.SaveRecordsSync(cfg.data_path_);
 
     auto hdl_factory = new HandlerFactory<sn::ServerConfig>(&cfg);
     hdl_factory->HandlePost<HdlShortUrlAdd>("/add");
+    hdl_factory->HandlePost<HdlShortUrlAddBatch>("/add/batch");
     hdl_factory->HandlePost<HdlShortUrlDel>("/del");
     hdl_factory->HandlePost<HdlShortUrlGet>("/get");
+    hdl_factory->HandlePost<HdlShortUrlGetBatch>("/get/batch");
+    hdl_factory->HandleGet<HdlShortUrlExport>("/export");
+    hdl_factory->HandleGet<HdlShortUrlExport>("/export/*");
     hdl_factory->HandleGet<HdlShortUrlJump>("/j/*");
+    hdl_factory->HandleGet<HdlShortUrlVisitors>("/stats/visitors");
+    hdl_factory->HandleGet<HdlShortUrlTop>("/stats/top");
+    hdl_factory->HandleGet<HdlShortUrlSeries>("/stats/series");
     hdl_factory->HandleGet<HdlShortUrlWebpage>("/webpage");
     hdl_factory->HandleGet<HdlShortUrlCfgGet>("/static/js/server-config.js");
     // hdl_factory->HandleGet<HdlShortUrlWebpage>("/static/**");
@@ -109,11 +134,19 @@ int main(int argc, char *argv[])
     auto last_save_time = std::chrono::high_resolution_clock::now();
     while (true) {
         std::this_thread::sleep_for(std::chrono::seconds(1));
+        Rcu::Reclaim();
+        mgr.ReapExpired();
+        mgr.MergeClicks();
         auto now_time = std::chrono::high_resolution_clock::now();
         auto delta = std::chrono::duration_cast<chrono::seconds>(now_time - last_save_time).count();
-        if (delta >= cfg.save_internal_ && mgr.IsModified()) {
+        bool need_save = (delta >= cfg.save_internal_ && mgr.IsModified()) ||
+            (delta >= cfg.click_save_internal_ && mgr.IsClicksModified());
+        if (need_save && !mgr.IsLoading()) {
             last_save_time = now_time;
-            if (cfg.save_async_)
+            cfg.mgr_->CompactRecords();
+            if (cfg.save_fork_)
+                cfg.mgr_->SaveRecordsFork(cfg.data_path_);
+            else if (cfg.save_async_)
                 cfg.mgr_->SaveRecordsAsync(cfg.data_path_);
             else
                 cfg.mgr_->SaveRecordsSync(cfg.data_path_);
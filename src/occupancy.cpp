@@ -0,0 +1,81 @@
+#include "occupancy.h"
+
+namespace sn {
+
+// bits per key of the bloom filter, with 8 bits set per key it stays near 0.1% false positives
+static constexpr std::size_t BLOOM_BITS_PER_KEY = 16;
+
+static inline std::uint64_t BloomHash(const HashKey &key) {
+    std::uint64_t h = key.lo_ * 0x9E3779B97F4A7C15ull ^ key.hi_;
+    h ^= h >> 31;
+    h *= 0xBF58476D1CE4E5B9ull;
+    h ^= h >> 29;
+    return h;
+}
+
+HashOccupancy::HashOccupancy(int width, KeyAlphabet alphabet, std::size_t expect) : width_(width), alphabet_(alphabet),
+    exact_(HashKey::Space(alphabet, width) <= DENSE_MAX_SPACE), expect_(expect), block_num_(0), count_(0), removed_(0) {
+    if (exact_) {
+        auto bits = static_cast<std::size_t>(HashKey::Space(alphabet, width));
+        block_num_ = (bits + sizeof(Block) * 8 - 1) / (sizeof(Block) * 8);
+    } else {
+        block_num_ = (expect < 1024 ? 1024 : expect) * BLOOM_BITS_PER_KEY / (sizeof(Block) * 8);
+    }
+    blocks_.reset(new Block[block_num_]);
+    for (std::size_t i = 0; i < block_num_; ++i) {
+        for (auto &word : blocks_[i].words_)
+            word.store(0, std::memory_order_relaxed);
+    }
+}
+
+bool HashOccupancy::MayContain(const HashKey &key) const {
+    if (!IsTracked(key))
+        return false;
+    if (exact_) {
+        auto bit = static_cast<std::uint64_t>(key.Value());
+        return (blocks_[bit >> 9].words_[(bit >> 6) & 7].load(std::memory_order_acquire) >> (bit & 63)) & 1;
+    }
+    auto h = BloomHash(key);
+    auto &block = blocks_[static_cast<std::uint64_t>((static_cast<unsigned __int128>(h) * block_num_) >> 64)];
+    // the high bits picked the block, the bit positions come from the low ones
+    auto bits = h;
+    for (int i = 0; i < 8; ++i, bits >>= 6) {
+        if (((block.words_[i].load(std::memory_order_acquire) >> (bits & 63)) & 1) == 0)
+            return false;
+    }
+    return true;
+}
+
+void HashOccupancy::Add(const HashKey &key) {
+    if (!IsTracked(key))
+        return;
+    count_.fetch_add(1, std::memory_order_relaxed);
+    if (exact_) {
+        auto bit = static_cast<std::uint64_t>(key.Value());
+        blocks_[bit >> 9].words_[(bit >> 6) & 7].fetch_or(std::uint64_t(1) << (bit & 63), std::memory_order_release);
+        return;
+    }
+    auto h = BloomHash(key);
+    auto &block = blocks_[static_cast<std::uint64_t>((static_cast<unsigned __int128>(h) * block_num_) >> 64)];
+    auto bits = h;
+    for (int i = 0; i < 8; ++i, bits >>= 6)
+        block.words_[i].fetch_or(std::uint64_t(1) << (bits & 63), std::memory_order_release);
+}
+
+void HashOccupancy::Remove(const HashKey &key) {
+    if (!IsTracked(key))
+        return;
+    count_.fetch_sub(1, std::memory_order_relaxed);
+    if (exact_) {
+        auto bit = static_cast<std::uint64_t>(key.Value());
+        blocks_[bit >> 9].words_[(bit >> 6) & 7].fetch_and(~(std::uint64_t(1) << (bit & 63)), std::memory_order_release);
+        return;
+    }
+    removed_.fetch_add(1, std::memory_order_relaxed);
+}
+
+double HashOccupancy::Ratio() const {
+    return Count() / static_cast<double>(HashKey::Space(alphabet_, width_));
+}
+
+} /* namespace sn */
@@ -19,6 +19,7 @@ extern const std::map<int, std::string>& GetServerCodeStringMap(bool need_cn) {
 
         { INTERNAL_UNKNOWN_ERROR,       "unknown error" },
         { INTERNAL_REQUEST_ERROR,       "network error" },
+        { INTERNAL_STORAGE_ERROR,       "change not logged to disk" },
 
         { REQ_JSON_ERROR,               "json is wrong" },
         { REQ_PARAMS_ERROR,             "invalid json params" },
@@ -29,6 +30,7 @@ extern const std::map<int, std::string>& GetServerCodeStringMap(bool need_cn) {
 
         { INTERNAL_UNKNOWN_ERROR,       "未知错误" },
         { INTERNAL_REQUEST_ERROR,       "网络问题，请求错误" },
+        { INTERNAL_STORAGE_ERROR,       "写日志失败，改动未落盘" },
 
         { REQ_JSON_ERROR,               "请求 json 格式错误" },
         { REQ_PARAMS_ERROR,             "请求 json 中参数错误" },
@@ -0,0 +1,145 @@
+#include "rcu.h"
+
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace {
+
+struct alignas(64) ReaderSlot {
+    std::atomic<std::uint64_t> epoch_{0};   // 0 means not reading
+    std::atomic<bool> in_use_{false};
+};
+
+struct RetiredPtr {
+    void *ptr_;
+    void (*deleter_)(void*);
+    std::uint64_t epoch_;
+};
+
+// epoch 0 is reserved for idle slots
+std::atomic<std::uint64_t> g_epoch{1};
+std::mutex g_slots_mtx;
+std::vector<ReaderSlot*> g_slots;
+// pending pointers are released at exit, no reader is alive by then
+struct RetiredList : public std::vector<RetiredPtr> {
+    ~RetiredList() {
+        for (auto &retired : *this)
+            retired.deleter_(retired.ptr_);
+    }
+};
+
+std::mutex g_retired_mtx;
+RetiredList g_retired;
+std::atomic<std::size_t> g_retired_cnt{0};
+
+const std::size_t RECLAIM_THRESHOLD = 256;
+
+struct LocalReader {
+    LocalReader() : depth_(0), slot_(nullptr) {
+        std::lock_guard<std::mutex> guard(g_slots_mtx);
+        for (auto slot : g_slots) {
+            if (!slot->in_use_.load(std::memory_order_relaxed)) {
+                slot_ = slot;
+                break;
+            }
+        }
+        if (slot_ == nullptr) {
+            slot_ = new ReaderSlot();
+            g_slots.emplace_back(slot_);
+        }
+        slot_->in_use_.store(true, std::memory_order_relaxed);
+    }
+    ~LocalReader() {
+        std::lock_guard<std::mutex> guard(g_slots_mtx);
+        slot_->epoch_.store(0, std::memory_order_release);
+        slot_->in_use_.store(false, std::memory_order_relaxed);
+    }
+    int depth_;
+    ReaderSlot *slot_;
+};
+
+LocalReader& GetLocalReader() {
+    static thread_local LocalReader reader;
+    return reader;
+}
+
+std::uint64_t MinReadingEpoch() {
+    std::uint64_t ret = g_epoch.load(std::memory_order_acquire);
+    std::lock_guard<std::mutex> guard(g_slots_mtx);
+    for (auto slot : g_slots) {
+        auto epoch = slot->epoch_.load(std::memory_order_acquire);
+        if (epoch != 0 && epoch < ret)
+            ret = epoch;
+    }
+    return ret;
+}
+
+} /* namespace */
+
+namespace sn {
+namespace Rcu {
+
+void ReadLock() {
+    auto &reader = GetLocalReader();
+    if (reader.depth_++ > 0)
+        return;
+    reader.slot_->epoch_.store(g_epoch.load(std::memory_order_acquire), std::memory_order_relaxed);
+    // the slot must be visible before any protected pointer is loaded
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+}
+
+void ReadUnlock() {
+    auto &reader = GetLocalReader();
+    if (--reader.depth_ > 0)
+        return;
+    reader.slot_->epoch_.store(0, std::memory_order_release);
+}
+
+void Retire(void *ptr, void (*deleter)(void*)) {
+    {
+        std::lock_guard<std::mutex> guard(g_retired_mtx);
+        g_retired.emplace_back(RetiredPtr{ ptr, deleter, g_epoch.load(std::memory_order_acquire) });
+    }
+    if ((g_retired_cnt.fetch_add(1, std::memory_order_relaxed) + 1) % RECLAIM_THRESHOLD == 0)
+        Reclaim();
+}
+
+void Reclaim() {
+    std::vector<RetiredPtr> ready;
+    {
+        std::lock_guard<std::mutex> guard(g_retired_mtx);
+        if (g_retired.empty())
+            return;
+        g_epoch.fetch_add(1, std::memory_order_seq_cst);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        auto min_epoch = MinReadingEpoch();
+        std::size_t keep = 0;
+        for (auto &retired : g_retired) {
+            if (retired.epoch_ < min_epoch)
+                ready.emplace_back(retired);
+            else
+                g_retired[keep++] = retired;
+        }
+        g_retired.resize(keep);
+        g_retired_cnt.store(keep, std::memory_order_relaxed);
+    }
+    // deleters may retire again, so run them without the lock
+    for (auto &retired : ready)
+        retired.deleter_(retired.ptr_);
+}
+
+void Synchronize() {
+    auto epoch = g_epoch.fetch_add(1, std::memory_order_seq_cst);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    while (MinReadingEpoch() <= epoch)
+        std::this_thread::yield();
+    Reclaim();
+}
+
+std::size_t PendingCount() {
+    return g_retired_cnt.load(std::memory_order_relaxed);
+}
+
+} /* namespace Rcu */
+} /* namespace sn */
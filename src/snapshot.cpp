@@ -0,0 +1,357 @@
+#include "snapshot.h"
+#include "util/LoggerUtil.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace sn {
+
+static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__, "snapshot files are little endian");
+
+static const char SNAPSHOT_MAGIC[8] = { 'S', 'N', 'U', 'R', 'L', 'S', 'N', 'P' };
+
+struct SnapshotFile::Header {
+    char magic_[8];
+    std::uint32_t version_;
+    std::uint32_t entry_size_;
+    std::uint64_t count_;
+    std::uint64_t index_offset_;
+    std::uint64_t blob_offset_;
+    std::uint64_t blob_size_;
+    std::uint64_t checksum_;
+    // KeyPermutation::Pack of the sequence lease, 0 if none
+    std::uint64_t sequence_;
+};
+
+// entries are ordered like HashKey
+struct SnapshotFile::Entry {
+    std::uint64_t hash_hi_;
+    std::uint64_t hash_lo_;
+    std::int64_t expire_at_;
+    std::uint64_t url_offset_;
+    std::uint32_t url_size_;
+    // bytes of the visitor sketch after the url, 0 if none was kept
+    std::uint32_t visitors_size_;
+    std::uint64_t clicks_;
+    std::uint8_t hash_width_;
+    std::uint8_t hash_alphabet_;
+    std::uint8_t pad_[6];
+};
+
+// word at a time, a tail shorter than a word is zero padded. a stream fed in
+// pieces sums the same as a whole as long as only the last piece has a tail
+static std::uint64_t ChecksumUpdate(std::uint64_t h, const char *data, std::size_t size) {
+    auto mix = [](std::uint64_t h, std::uint64_t word) {
+        h ^= word * 0x9E3779B97F4A7C15ull;
+        h = (h << 29) | (h >> 35);
+        return h * 0xBF58476D1CE4E5B9ull;
+    };
+    std::uint64_t word;
+    for (; size >= 8; data += 8, size -= 8) {
+        std::memcpy(&word, data, 8);
+        h = mix(h, word);
+    }
+    if (size > 0) {
+        word = 0;
+        std::memcpy(&word, data, size);
+        h = mix(h, word);
+    }
+    return h;
+}
+
+// sums size bytes of fd at offset into h, read back in pieces of whole words
+static int ChecksumRange(int fd, std::uint64_t offset, std::uint64_t size, std::uint64_t &h) {
+    std::string buf(1 << 20, '\0');
+    while (size > 0) {
+        std::size_t piece = std::min<std::uint64_t>(size, buf.size());
+        for (std::size_t done = 0; done < piece; ) {
+            auto ret = ::pread(fd, &buf[done], piece - done, offset + done);
+            if (ret < 0 && errno == EINTR)
+                continue;
+            if (ret <= 0)
+                return ret < 0 ? errno : EIO;
+            done += ret;
+        }
+        h = ChecksumUpdate(h, buf.data(), piece);
+        offset += piece;
+        size -= piece;
+    }
+    return 0;
+}
+
+// buffers writes to fd from offset on and sums everything it writes, unless sum is false
+class SnapshotFile::ChecksumWriter {
+public:
+    ChecksumWriter(int fd, std::uint64_t offset, bool sum = true) : fd_(fd), offset_(offset), sum_(sum), checksum_(0),
+        err_(0) {
+        buf_.reserve(BUF_SIZE + 64);
+    }
+
+    void Append(const void *data, std::size_t size) {
+        buf_.append(static_cast<const char*>(data), size);
+        if (buf_.size() >= BUF_SIZE)
+            Flush(false);
+    }
+    // 0 or the errno of the first failed write
+    int Finish() {
+        Flush(true);
+        return err_;
+    }
+    std::uint64_t Checksum() const { return checksum_; }
+
+private:
+    static constexpr std::size_t BUF_SIZE = 1 << 20;
+
+    void Flush(bool last) {
+        // keep partial words for the next piece
+        auto size = last ? buf_.size() : buf_.size() / 8 * 8;
+        if (sum_)
+            checksum_ = ChecksumUpdate(checksum_, buf_.data(), size);
+        for (std::size_t done = 0; err_ == 0 && done < size; ) {
+            auto ret = ::pwrite(fd_, buf_.data() + done, size - done, offset_ + done);
+            if (ret < 0 && errno == EINTR)
+                continue;
+            if (ret < 0) {
+                err_ = errno;
+                break;
+            }
+            done += ret;
+        }
+        offset_ += size;
+        buf_.erase(0, size);
+    }
+
+    int fd_;
+    std::uint64_t offset_;
+    bool sum_;
+    std::string buf_;
+    std::uint64_t checksum_;
+    int err_;
+};
+
+SnapshotFile::~SnapshotFile() {
+    if (base_ != nullptr)
+        ::munmap(const_cast<char*>(base_), map_size_);
+}
+
+std::unique_ptr<SnapshotFile> SnapshotFile::Open(const std::string &path) {
+    auto fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        LOGUTIL_LOG_E() << "open snapshot " << path << " failed: " << std::strerror(errno);
+        return nullptr;
+    }
+    struct stat st;
+    if (::fstat(fd, &st) != 0 || st.st_size < static_cast<off_t>(sizeof(Header))) {
+        LOGUTIL_LOG_E() << "snapshot " << path << " is truncated";
+        ::close(fd);
+        return nullptr;
+    }
+    auto base = ::mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (base == MAP_FAILED) {
+        LOGUTIL_LOG_E() << "mmap snapshot " << path << " failed: " << std::strerror(errno);
+        return nullptr;
+    }
+    std::unique_ptr<SnapshotFile> snapshot(new SnapshotFile());
+    snapshot->base_ = static_cast<const char*>(base);
+    snapshot->map_size_ = st.st_size;
+    ::madvise(base, st.st_size, MADV_WILLNEED);
+
+    Header header;
+    std::memcpy(&header, base, sizeof(header));
+    std::uint64_t size = st.st_size;
+    if (std::memcmp(header.magic_, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) != 0 || header.version_ != VERSION ||
+            header.entry_size_ != sizeof(Entry)) {
+        LOGUTIL_LOG_E() << "snapshot " << path << " has unknown format, version " << header.version_;
+        return nullptr;
+    }
+    if (header.index_offset_ != sizeof(Header) || header.count_ > (size - header.index_offset_) / sizeof(Entry) ||
+            header.blob_offset_ != header.index_offset_ + header.count_ * sizeof(Entry) ||
+            header.blob_size_ != size - header.blob_offset_) {
+        LOGUTIL_LOG_E() << "snapshot " << path << " has a bad layout";
+        return nullptr;
+    }
+    snapshot->path_ = path;
+    snapshot->checksum_ = header.checksum_;
+    snapshot->entries_ = reinterpret_cast<const Entry*>(snapshot->base_ + header.index_offset_);
+    snapshot->count_ = header.count_;
+    snapshot->blob_ = snapshot->base_ + header.blob_offset_;
+    snapshot->blob_size_ = header.blob_size_;
+    snapshot->sequence_ = header.sequence_;
+    LOGUTIL_LOG_I() << "mapped snapshot " << path << " with " << snapshot->count_ << " records";
+    return snapshot;
+}
+
+bool SnapshotFile::Write(const std::string &path, std::vector<SnapshotRecord> &records, std::uint64_t sequence) {
+    auto err = WriteQuiet(path, records, sequence);
+    if (err != 0)
+        LOGUTIL_LOG_E() << "write snapshot " << path << " failed: " << std::strerror(err);
+    return err == 0;
+}
+
+void SnapshotFile::Prepare(std::vector<SnapshotRecord> &records, std::uint64_t sequence, Header &header) {
+    std::sort(records.begin(), records.end(), [](const SnapshotRecord &lhs, const SnapshotRecord &rhs) {
+        return lhs.hash_ < rhs.hash_;
+    });
+    InitHeader(records.size(), sequence, header);
+}
+
+void SnapshotFile::InitHeader(std::size_t count, std::uint64_t sequence, Header &header) {
+    static_assert(sizeof(Header) == 64 && sizeof(Entry) == 56, "layouts are part of the format");
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic_, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+    header.version_ = VERSION;
+    header.entry_size_ = sizeof(Entry);
+    header.count_ = count;
+    header.index_offset_ = sizeof(Header);
+    header.blob_offset_ = header.index_offset_ + count * sizeof(Entry);
+    header.sequence_ = sequence;
+}
+
+void SnapshotFile::FillEntry(const SnapshotRecord &rec, std::uint64_t blob_offset, Entry &entry) {
+    std::memset(&entry, 0, sizeof(entry));
+    entry.hash_hi_ = rec.hash_.hi_;
+    entry.hash_lo_ = rec.hash_.lo_;
+    entry.hash_width_ = rec.hash_.width_;
+    entry.hash_alphabet_ = rec.hash_.alphabet_;
+    entry.expire_at_ = rec.expire_at_;
+    entry.url_offset_ = blob_offset;
+    entry.url_size_ = rec.url_.size();
+    entry.visitors_size_ = rec.visitors_.size();
+    entry.clicks_ = rec.clicks_;
+}
+
+// the index then the url blob, blob_size_ of header counts up along
+void SnapshotFile::WriteBody(const std::vector<SnapshotRecord> &records, Header &header, ChecksumWriter &writer) {
+    header.blob_size_ = 0;
+    Entry entry;
+    for (auto &rec : records) {
+        FillEntry(rec, header.blob_size_, entry);
+        writer.Append(&entry, sizeof(entry));
+        header.blob_size_ += rec.url_.size() + rec.visitors_.size();
+    }
+    for (auto &rec : records) {
+        writer.Append(rec.url_.data(), rec.url_.size());
+        if (!rec.visitors_.empty())
+            writer.Append(rec.visitors_.data(), rec.visitors_.size());
+    }
+}
+
+int SnapshotFile::WriteQuiet(const std::string &path, std::vector<SnapshotRecord> &records, std::uint64_t sequence) {
+    Header header;
+    Prepare(records, sequence, header);
+    auto fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+        return errno;
+    ChecksumWriter writer(fd, header.index_offset_);
+    WriteBody(records, header, writer);
+    auto err = writer.Finish();
+    header.checksum_ = writer.Checksum();
+    if (err == 0)
+        err = WriteHeader(fd, header);
+    ::close(fd);
+    return err;
+}
+
+bool SnapshotFile::WriteSorted(const std::string &path, std::size_t count, std::uint64_t sequence, const RecordAt &at) {
+    Header header;
+    InitHeader(count, sequence, header);
+    auto fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    auto err = fd < 0 ? errno : 0;
+    if (fd >= 0) {
+        ChecksumWriter index(fd, header.index_offset_);
+        ChecksumWriter blob(fd, header.blob_offset_, false);
+        SnapshotRecord rec;
+        Entry entry;
+        for (std::size_t i = 0; i < count; ++i) {
+            at(i, rec);
+            FillEntry(rec, header.blob_size_, entry);
+            index.Append(&entry, sizeof(entry));
+            blob.Append(rec.url_.data(), rec.url_.size());
+            if (!rec.visitors_.empty())
+                blob.Append(rec.visitors_.data(), rec.visitors_.size());
+            header.blob_size_ += rec.url_.size() + rec.visitors_.size();
+        }
+        err = index.Finish();
+        auto blob_err = blob.Finish();
+        err = err != 0 ? err : blob_err;
+        // the sum of the blob goes on from the one of the index
+        header.checksum_ = index.Checksum();
+        if (err == 0)
+            err = ChecksumRange(fd, header.blob_offset_, header.blob_size_, header.checksum_);
+        if (err == 0)
+            err = WriteHeader(fd, header);
+        ::close(fd);
+    }
+    if (err != 0)
+        LOGUTIL_LOG_E() << "write snapshot " << path << " failed: " << std::strerror(err);
+    return err == 0;
+}
+
+// the header goes last, a crash before leaves a file Open rejects
+int SnapshotFile::WriteHeader(int fd, const Header &header) {
+    if (::fdatasync(fd) != 0)
+        return errno;
+    if (::pwrite(fd, &header, sizeof(header), 0) != static_cast<ssize_t>(sizeof(header)))
+        return errno != 0 ? errno : EIO;
+    if (::fdatasync(fd) != 0)
+        return errno;
+    return 0;
+}
+
+HashKey SnapshotFile::HashAt(std::size_t i) const {
+    auto &entry = entries_[i];
+    return HashKey((static_cast<unsigned __int128>(entry.hash_hi_) << 64) | entry.hash_lo_, entry.hash_width_,
+        static_cast<KeyAlphabet>(entry.hash_alphabet_));
+}
+
+bool SnapshotFile::Verify() const {
+    if (ChecksumUpdate(0, base_ + sizeof(Header), map_size_ - sizeof(Header)) != checksum_) {
+        LOGUTIL_LOG_E() << "snapshot " << path_ << " checksum mismatch";
+        return false;
+    }
+    for (std::size_t i = 0; i < count_; ++i) {
+        if (!ValidEntry(i) || (i > 0 && !(HashAt(i - 1) < HashAt(i)))) {
+            LOGUTIL_LOG_E() << "snapshot " << path_ << " has a bad entry " << i;
+            return false;
+        }
+    }
+    return true;
+}
+
+bool SnapshotFile::ValidEntry(std::size_t i) const {
+    auto &entry = entries_[i];
+    auto hash = HashAt(i);
+    return !hash.Empty() && hash.Alphabet() <= KEY_ALPHABET_BASE58 && hash.Width() <= HashKey::MaxWidth(hash.Alphabet()) &&
+        entry.url_offset_ <= blob_size_ && std::uint64_t(entry.url_size_) + entry.visitors_size_ <= blob_size_ - entry.url_offset_;
+}
+
+SnapshotRecord SnapshotFile::At(std::size_t i) const {
+    auto &entry = entries_[i];
+    auto url = blob_ + entry.url_offset_;
+    return SnapshotRecord{ HashAt(i), entry.expire_at_, std::string_view(url, entry.url_size_), entry.clicks_,
+        std::string_view(url + entry.url_size_, entry.visitors_size_) };
+}
+
+bool SnapshotFile::Find(const HashKey &hash, SnapshotRecord &rec) const {
+    std::size_t lo = 0, hi = count_;
+    while (lo < hi) {
+        auto mid = lo + (hi - lo) / 2;
+        if (HashAt(mid) < hash)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    // served before Verify, a bad index may only miss, never point out of the file
+    if (lo == count_ || HashAt(lo) != hash || !ValidEntry(lo))
+        return false;
+    rec = At(lo);
+    return true;
+}
+
+} /* namespace sn */
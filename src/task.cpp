@@ -2,242 +2,1808 @@
 #include "util/FileUtil.h"
 #include "util/LoggerUtil.h"
 #include "util/md5.h"
+#include "util/md5_lanes.h"
+#include "hash_key.h"
+#ifdef USE_OPENMP
+#include <omp.h>
+#endif
 
+#include <cerrno>
 #include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <unistd.h>
 #include <mutex>
+#include <new>
+#include <chrono>
+#include <cmath>
 #include <string>
 #include <thread>
 
 using namespace sn;
 
-ShortUrlMgr::ShortUrlMgr(): backuping_(false), modified_(false), hash_width_(12) {
+static inline ShortUrlRecord* FindRecord(const HashRecordSet &recs, const HashKey &hash) {
+    ShortUrlRecord probe(hash);
+    return recs.Find(&probe);
+}
+
+static inline ShortUrlRecord* FindRecord(const UrlRecordSet &recs, std::string_view url) {
+    ShortUrlRecord probe(HashKey(), url);
+    return recs.Find(&probe);
+}
+
+// a copy of the visitor sketch of info kept in sketches for rec
+// appends HyperLogLog::Serialize of the visitors of info to out, false if it has none
+static bool SerializeVisitors(const ShortUrlRecord *info, std::string &out) {
+    auto stats = info->stats_.load(std::memory_order_acquire);
+    if (stats == nullptr)
+        return false;
+    std::lock_guard<std::mutex> guard(stats->mtx_);
+    stats->visitors_.Serialize(out);
+    return true;
+}
+
+static void CopyVisitors(const ShortUrlRecord *info, std::deque<std::string> &sketches, SnapshotRecord &rec) {
+    sketches.emplace_back();
+    if (SerializeVisitors(info, sketches.back()))
+        rec.visitors_ = sketches.back();
+    else
+        sketches.pop_back();
+}
+
+// the stats of info, made on first use. one writer at a time, see MergeClicks
+static LinkStats* MakeStats(ShortUrlRecord *info) {
+    auto stats = info->stats_.load(std::memory_order_acquire);
+    if (stats == nullptr) {
+        stats = new LinkStats();
+        info->stats_.store(stats, std::memory_order_release);
+    }
+    return stats;
+}
 
+// adds a saved visitor sketch to those of info, a broken one is dropped
+static void MergeVisitors(ShortUrlRecord *info, std::string_view sketch) {
+    HyperLogLog visitors;
+    if (sketch.empty() || !visitors.Deserialize(sketch))
+        return;
+    auto stats = MakeStats(info);
+    std::lock_guard<std::mutex> guard(stats->mtx_);
+    stats->visitors_.Merge(visitors);
+}
+
+static inline std::int64_t SteadyMicros() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// only drop the url entry while it still points to the record
+static inline void EraseUrlRecord(UrlRecordSet &recs, ShortUrlRecord *info) {
+    if (recs.Find(info) == info)
+        recs.Erase(info);
+}
+
+ShortUrlRecord* ShortUrlRecord::Create(SlabAllocator &slab, BumpArena &url_bytes,
+        std::string_view url, const HashKey &hash, const std::int64_t tm) {
+    auto url_mem = url_bytes.Alloc(url.size());
+    if (!url.empty())
+        std::memcpy(url_mem, url.data(), url.size());
+    return new (slab.Alloc()) ShortUrlRecord(hash, std::string_view(url_mem, url.size()), tm);
+}
+
+void ShortUrlRecord::Destroy(void *rec) {
+    auto info = static_cast<ShortUrlRecord*>(rec);
+    delete info->stats_.load(std::memory_order_relaxed);
+    BumpArena::Free(info->url_.data(), info->url_.size());
+    info->~ShortUrlRecord();
+    SlabAllocator::Free(rec);
+}
+
+ShortUrlMgr::ShortUrlMgr(): backuping_(false), freeze_refs_(0), modified_(false), clicks_modified_(false), keep_txt_(false), started_(false), loading_(false), fork_saving_(false), lazy_snapshot_(nullptr),
+    hash_width_(12), hash_width_max_(HashKey::MAX_WIDTH), probe_budget_(0), window_adds_(0), window_probes_(0),
+    window_start_us_(SteadyMicros()), probe_mean_(0), add_rate_(0), escalate_pending_(false), key_alphabet_(KEY_ALPHABET_HEX),
+    hash_mode_(HASH_MODE_MD5), url_hash_func_(URL_HASH_MD5), sequence_next_(KeyPermutation::Pack(12, KEY_ALPHABET_HEX, 0)),
+    sequence_leased_(KeyPermutation::Pack(12, KEY_ALPHABET_HEX, 0)), shard_mask_(0), load_threads_(0), click_series_(false),
+    occupancy_(new HashOccupancy(12, KEY_ALPHABET_HEX, 0)), expiry_wheel_(UnixSeconds()), hot_links_(UnixSeconds()) {
+    SetShardNum(16);
 }
 
 ShortUrlMgr::~ShortUrlMgr() {
+    WaitLoaded();
+    // wait for the tail of an async save
+    std::lock_guard<std::mutex> save_guard(save_mtx_);
+    // retired records go back to the arenas, which release everything left
+    Rcu::Synchronize();
+    delete occupancy_.load();
+}
 
+ShortUrlRecord* ShortUrlMgr::CreateRecord(std::string_view url, const HashKey &hash, const std::int64_t tm) {
+    auto &arena = GetArena(hash);
+    return ShortUrlRecord::Create(arena.slab_, arena.url_bytes_, url, hash, tm);
 }
 
-std::string ShortUrlMgr::AddUrl(const std::string &url) {
-    std::unique_lock<std::shared_mutex> guard(mtx_);
-    auto info_it = url2recs_.find(url);
-    if (info_it != url2recs_.end()) {
-        auto &info = info_it->second;
-        if (backuping_ && extra_deleted_hashs_.count(info->hash_) > 0) {
-            extra_deleted_hashs_.erase(info->hash_);
-            modified_ = true;
+void ShortUrlMgr::SetHashWidth(int width) {
+    auto max_width = HashKey::MaxWidth(key_alphabet_);
+    if (width < 1 || width > max_width) {
+        LOGUTIL_LOG_W() << "hash width " << width << " out of range [1, " << max_width << "]";
+        width = width < 1 ? 1 : max_width;
+    }
+    if (width == hash_width_)
+        return;
+    auto guards = LockAllShards();
+    hash_width_ = width;
+    RebuildOccupancy(0);
+    ResetSequence();
+}
+
+void ShortUrlMgr::SetKeyAlphabet(KeyAlphabet alphabet) {
+    if (alphabet == key_alphabet_)
+        return;
+    auto guards = LockAllShards();
+    key_alphabet_ = alphabet;
+    auto max_width = HashKey::MaxWidth(alphabet);
+    if (hash_width_ > max_width)
+        hash_width_ = max_width;
+    hash_width_max_ = std::min(hash_width_max_, max_width);
+    RebuildOccupancy(0);
+    ResetSequence();
+}
+
+void ShortUrlMgr::RebuildOccupancy(std::size_t expect) {
+    std::size_t count = 0;
+    for (auto &hash_shard : hash_shards_)
+        count += hash_shard->hash2recs_.Size() + hash_shard->extra_hash2recs_.Size();
+    // a bloom filter is sized for twice the keys, then rebuilt when it is full
+    auto occupancy = new HashOccupancy(hash_width_, key_alphabet_, (count + expect) * 2);
+    for (auto &hash_shard : hash_shards_) {
+        for (auto info : hash_shard->hash2recs_)
+            occupancy->Add(info->hash_);
+        for (auto info : hash_shard->extra_hash2recs_)
+            occupancy->Add(info->hash_);
+    }
+    auto old_occupancy = occupancy_.exchange(occupancy, std::memory_order_acq_rel);
+    if (old_occupancy != nullptr)
+        Rcu::RetireDelete(old_occupancy);
+    LOGUTIL_LOG_I() << "occupancy index for width " << hash_width_ << " " << KeyAlphabetName(key_alphabet_) <<
+        (occupancy->IsExact() ? " bitset " : " bloom ") <<
+        occupancy->Bytes() << " bytes, " << occupancy->Count() << " keys";
+}
+void ShortUrlMgr::SetProbeBudget(double probes, int max_width) {
+    probe_budget_ = probes;
+    hash_width_max_ = std::min(std::max(max_width, hash_width_.load()), HashKey::MaxWidth(key_alphabet_));
+}
+
+void ShortUrlMgr::CountProbes(std::uint32_t probes) {
+    auto window_probes = window_probes_.fetch_add(probes, std::memory_order_relaxed) + probes;
+    if (window_adds_.fetch_add(1, std::memory_order_relaxed) + 1 != PROBE_WINDOW)
+        return;
+    // the add closing the window judges it, adds racing with the reset only blur the next one
+    window_probes_.fetch_sub(window_probes, std::memory_order_relaxed);
+    window_adds_.fetch_sub(PROBE_WINDOW, std::memory_order_relaxed);
+    auto now_us = SteadyMicros();
+    auto start_us = window_start_us_.exchange(now_us, std::memory_order_relaxed);
+    double mean = static_cast<double>(window_probes) / PROBE_WINDOW;
+    probe_mean_ = mean;
+    add_rate_ = PROBE_WINDOW * 1e6 / std::max<std::int64_t>(now_us - start_us, 1);
+    if (probe_budget_ > 1 && mean > probe_budget_ && hash_width_ < hash_width_max_)
+        escalate_pending_ = true;
+}
+
+bool ShortUrlMgr::EscalateHashWidth(const char *reason) {
+    int width = hash_width_;
+    if (width >= hash_width_max_) {
+        LOGUTIL_LOG_W() << "hash width " << width << " is the max, " << reason;
+        return false;
+    }
+    hash_width_ = width + 1;
+    RebuildOccupancy(0);
+    ResetSequence();
+    LOGUTIL_LOG_W() << "hash width " << width << " -> " << width + 1 << ", " << reason;
+    return true;
+}
+
+void ShortUrlMgr::EscalateByLoad() {
+    // an escalation before the restart may be ahead of the load, the rounds
+    // went over budget a little early or the sequence ran out. new hashs go
+    // on with the widest width given out
+    int widest = hash_width_;
+    if (probe_budget_ > 1) {
+        for (auto &hash_shard : hash_shards_) {
+            for (auto info : hash_shard->hash2recs_) {
+                if (info->hash_.Alphabet() == key_alphabet_)
+                    widest = std::max(widest, info->hash_.Width());
+            }
         }
-        return info->hash_;
     }
-    if (backuping_) {
-        auto extra_it = extra_url2recs_.find(url);
-        if (extra_it != extra_url2recs_.end())
-            return extra_it->second->hash_;
+    if (hash_mode_ == HASH_MODE_SEQUENCE && KeyPermutation::PackedAlphabet(sequence_leased_) == key_alphabet_)
+        widest = std::max(widest, KeyPermutation::PackedWidth(sequence_leased_));
+    widest = std::min(widest, hash_width_max_);
+    if (widest > hash_width_) {
+        LOGUTIL_LOG_I() << "hash width " << hash_width_ << " -> " << widest << " as given before";
+        hash_width_ = widest;
+        RebuildOccupancy(0);
     }
-    auto hash = GenerateHash(url);
-    auto info = std::make_shared<ShortUrlRecord>(url, hash, 0);
-    if (backuping_) {
-        extra_url2recs_[url] = info;
-        extra_hash2recs_[hash] = info;
+    if (probe_budget_ <= 1)
+        return;
+    // rounds of a uniform hash average 1 / (1 - ratio)
+    while (occupancy_.load(std::memory_order_relaxed)->Ratio() > 1 - 1 / probe_budget_) {
+        if (!EscalateHashWidth("load over probe budget"))
+            break;
+    }
+}
+
+void ShortUrlMgr::SetHashMode(HashMode mode, const std::string &secret) {
+    hash_mode_ = mode;
+    permutation_.reset(new KeyPermutation(secret));
+    if (mode == HASH_MODE_SEQUENCE && secret.empty())
+        LOGUTIL_LOG_W() << "sequence hashs without a secret can be guessed";
+}
+
+void ShortUrlMgr::ResetSequence() {
+    std::lock_guard<std::mutex> guard(sequence_mtx_);
+    if (KeyPermutation::PackedWidth(sequence_next_) == hash_width_ &&
+            KeyPermutation::PackedAlphabet(sequence_next_) == key_alphabet_)
+        return;
+    sequence_next_ = KeyPermutation::Pack(hash_width_, key_alphabet_, 0);
+    sequence_leased_ = KeyPermutation::Pack(hash_width_, key_alphabet_, 0);
+}
+
+void ShortUrlMgr::ExtendSequenceLease(std::uint64_t seq) {
+    std::lock_guard<std::mutex> guard(sequence_mtx_);
+    if (seq < sequence_leased_.load(std::memory_order_relaxed))
+        return;
+    auto width = KeyPermutation::PackedWidth(seq);
+    auto alphabet = KeyPermutation::PackedAlphabet(seq);
+    auto end = std::min(KeyPermutation::PackedNum(seq) + SEQUENCE_LEASE, KeyPermutation::Space(width, alphabet));
+    // logged before any number of it is used, so a replay never hands one out twice
+    if (wal_ != nullptr) {
+        wal_->Append("0 ++++\n" + std::to_string(width) + " " + std::to_string(end) + " " +
+            KeyAlphabetName(alphabet) + "\n");
+    }
+    sequence_leased_.store(KeyPermutation::Pack(width, alphabet, end), std::memory_order_release);
+}
+
+HashKey ShortUrlMgr::NextSequenceHash(const std::string &url, std::uint32_t &probes, bool locked) {
+    Rcu::ReadGuard rcu_guard;
+    auto occupancy = occupancy_.load(std::memory_order_acquire);
+    while (true) {
+        auto seq = sequence_next_.fetch_add(1, std::memory_order_relaxed);
+        auto width = KeyPermutation::PackedWidth(seq);
+        auto alphabet = KeyPermutation::PackedAlphabet(seq);
+        auto num = KeyPermutation::PackedNum(seq);
+        // the width changed meanwhile, or it is used up and md5 goes one char
+        // wider until AddUrl escalates, a full width would never give a hash
+        bool current = width == occupancy->Width() && alphabet == occupancy->Alphabet() && KeyPermutation::Fits(width, alphabet);
+        if (!current || num >= KeyPermutation::Space(width, alphabet)) {
+            int md5_width = 0;
+            if (current && width < hash_width_max_) {
+                escalate_pending_ = true;
+                md5_width = width + 1;
+            }
+            std::uint32_t rounds = 0;
+            auto ret = DoGenerateHash(url, &rounds, md5_width, nullptr, locked);
+            probes += rounds;
+            return ret;
+        }
+        if (seq >= sequence_leased_.load(std::memory_order_acquire))
+            ExtendSequenceLease(seq);
+        ++probes;
+        // only md5 hashs given before the mode changed are in the way
+        auto ret = permutation_->Permute(num, width, alphabet);
+        if (!ret.IsSpelledHex() && IsHashFree(occupancy, ret, locked))
+            return ret;
+    }
+}
+
+std::uint64_t ShortUrlMgr::RotateWal(std::uint64_t &sequence) {
+    // a lease is either in the closed segments and the snapshot or in the next segment
+    std::lock_guard<std::mutex> guard(sequence_mtx_);
+    sequence = sequence_leased_;
+    return wal_ != nullptr ? wal_->Rotate() : 0;
+}
+
+HashWidthForecast ShortUrlMgr::ForecastHashWidth() const {
+    Rcu::ReadGuard guard;
+    auto occupancy = occupancy_.load(std::memory_order_acquire);
+    HashWidthForecast forecast{ occupancy->Width(), probe_mean_, occupancy->Count(), -1, -1 };
+    if (probe_budget_ <= 1 || forecast.width_ >= hash_width_max_)
+        return forecast;
+    forecast.escalate_at_ = std::floor((1 - 1 / probe_budget_) *
+        static_cast<double>(HashKey::Space(occupancy->Alphabet(), forecast.width_)));
+    double rate = add_rate_;
+    if (rate > 0)
+        forecast.eta_sec_ = std::max(forecast.escalate_at_ - forecast.taken_, 0.0) / rate;
+    return forecast;
+}
+
+bool ShortUrlMgr::IsOccupancyFull() const {
+    Rcu::ReadGuard guard;
+    auto occupancy = occupancy_.load(std::memory_order_acquire);
+    // removed keys still fill the bloom filter, churn alone gets it rebuilt too
+    return !occupancy->IsExact() && occupancy->Filled() > occupancy->Expect();
+}
+double ShortUrlMgr::GetOccupancyRatio() const {
+    Rcu::ReadGuard guard;
+    return occupancy_.load(std::memory_order_acquire)->Ratio();
+}
+std::size_t ShortUrlMgr::GetRecordCount() {
+    std::size_t count = 0;
+    for (auto &hash_shard : hash_shards_) {
+        std::shared_lock<std::shared_mutex> guard(hash_shard->mtx_);
+        count += hash_shard->hash2recs_.Size() + hash_shard->extra_hash2recs_.Size() - hash_shard->extra_deleted_hashs_.Size();
+    }
+    return count;
+}
+
+void ShortUrlMgr::SetShardNum(int num) {
+    std::size_t shard_num = 1;
+    while (shard_num < static_cast<std::size_t>(std::max(num, 1)))
+        shard_num <<= 1;
+    if (shard_num == hash_shards_.size())
+        return;
+    // readers go through index_ and the shard vectors without any lock
+    if (started_) {
+        LOGUTIL_LOG_W() << "can not reshard after loading, keep shard num " << hash_shards_.size();
+        return;
+    }
+    std::vector<ShortUrlRecord*> infos;
+    for (auto &hash_shard : hash_shards_)
+        infos.insert(infos.end(), hash_shard->hash2recs_.begin(), hash_shard->hash2recs_.end());
+    hash_shards_.clear();
+    url_shards_.clear();
+    for (std::size_t i = 0; i < shard_num; ++i) {
+        hash_shards_.emplace_back(new HashShard());
+        url_shards_.emplace_back(new UrlShard());
+    }
+    shard_mask_ = shard_num - 1;
+    while (arenas_.size() < shard_num)
+        arenas_.emplace_back(new RecordArena());
+    for (auto info : infos) {
+        auto &hash_shard = GetHashShard(info->hash_);
+        hash_shard.hash2recs_.Insert(info);
+        hash_shard.index_.Insert(info);
+        GetUrlShard(info->url_).url2recs_.Insert(info);
+    }
+    LOGUTIL_LOG_I() << "shard num set to " << shard_num;
+}
+
+ShortUrlMgr::ShardGuards ShortUrlMgr::LockAllShards() {
+    ShardGuards guards;
+    guards.reserve(url_shards_.size() + hash_shards_.size());
+    for (auto &url_shard : url_shards_)
+        guards.emplace_back(url_shard->mtx_);
+    for (auto &hash_shard : hash_shards_)
+        guards.emplace_back(hash_shard->mtx_);
+    return guards;
+}
+ShortUrlMgr::ShardGuards ShortUrlMgr::LockShards(const std::vector<char> &url_marks, const std::vector<char> &hash_marks) {
+    ShardGuards guards;
+    for (std::size_t i = 0; i < url_shards_.size(); ++i) {
+        if (url_marks[i])
+            guards.emplace_back(url_shards_[i]->mtx_);
+    }
+    for (std::size_t i = 0; i < hash_shards_.size(); ++i) {
+        if (hash_marks[i])
+            guards.emplace_back(hash_shards_[i]->mtx_);
+    }
+    return guards;
+}
+
+std::uint64_t ShortUrlMgr::LogRecord(const ShortUrlRecord *info) {
+    if (wal_ == nullptr)
+        return 0;
+    std::string entry = std::to_string(info->expire_at_.load(std::memory_order_relaxed)) + " " + info->hash_.ToString() + "\n";
+    entry.append(info->url_.data(), info->url_.size()).push_back('\n');
+    return wal_->Append(entry);
+}
+std::uint64_t ShortUrlMgr::LogTombstone(const HashKey &hash) {
+    if (wal_ == nullptr)
+        return 0;
+    return wal_->Append("0 ----\n" + hash.ToString() + "\n");
+}
+
+bool ShortUrlMgr::CommitLog(std::uint64_t wal_seq, bool *logged) {
+    bool ok = wal_seq == 0 || wal_->Commit(wal_seq);
+    if (logged != nullptr)
+        *logged = ok;
+    return ok;
+}
+
+std::string ShortUrlMgr::AddUrl(const std::string &url, std::int64_t ttl_sec, bool *logged) {
+    WaitLoaded();
+    std::uint64_t wal_seq = 0;
+    auto hash = DoAddUrl(url, ttl_sec > 0 ? UnixSeconds() + ttl_sec : 0, wal_seq);
+    CommitLog(wal_seq, logged);
+    EscalateIfPending();
+    return hash;
+}
+std::vector<std::string> ShortUrlMgr::AddUrls(const std::vector<std::string> &urls, bool *logged) {
+    WaitLoaded();
+    std::vector<std::string> hashs;
+    hashs.reserve(urls.size());
+    // only the first md5 round of a url is known ahead, retries and the other modes go one by one
+    bool batch_md5 = hash_mode_ == HASH_MODE_MD5 && url_hash_func_ == URL_HASH_MD5;
+    std::unique_ptr<md5::byte[][16]> digests(batch_md5 ? new md5::byte[urls.size()][16] : nullptr);
+    long chunk_num = (urls.size() + ADD_BATCH_SIZE - 1) / ADD_BATCH_SIZE;
+    if (batch_md5) {
+        // the digests do not depend on each other, big batches spread them over the load threads
+        int threads = GetWorkerThreads();
+#pragma omp parallel for schedule(static) num_threads(threads) if(chunk_num >= ADD_PARALLEL_CHUNKS)
+        for (long c = 0; c < chunk_num; ++c) {
+            auto begin = c * ADD_BATCH_SIZE;
+            auto end = std::min(urls.size(), begin + ADD_BATCH_SIZE);
+            std::vector<std::string_view> inputs(urls.begin() + begin, urls.begin() + end);
+            md5::DigestBatch(inputs.data(), inputs.size(), digests.get() + begin);
+        }
     }
-    else {
-        url2recs_[url] = info;
-        hash2recs_[hash] = info;
+    hashs.resize(urls.size());
+    std::uint64_t wal_seq = 0;
+    std::vector<char> url_marks(url_shards_.size()), hash_marks(hash_shards_.size());
+    std::vector<HashKey> firsts;
+    for (std::size_t begin = 0; begin < urls.size(); begin += ADD_BATCH_SIZE) {
+        auto end = std::min(urls.size(), begin + ADD_BATCH_SIZE);
+        auto next = begin;
+        while (next < end) {
+            if (batch_md5) {
+                // the first round hashs pick the shards, only those are locked
+                int width = 0;
+                KeyAlphabet alphabet = KEY_ALPHABET_HEX;
+                {
+                    Rcu::ReadGuard rcu_guard;
+                    auto occupancy = occupancy_.load(std::memory_order_acquire);
+                    width = occupancy->Width();
+                    alphabet = occupancy->Alphabet();
+                }
+                std::fill(url_marks.begin(), url_marks.end(), 0);
+                std::fill(hash_marks.begin(), hash_marks.end(), 0);
+                firsts.clear();
+                for (auto i = next; i < end; ++i) {
+                    firsts.push_back(HashKey::FromDigest(digests[i], width, alphabet));
+                    url_marks[UrlShardIndex(urls[i])] = 1;
+                    hash_marks[HashShardIndex(firsts.back())] = 1;
+                }
+                // readers by hash go on under rcu, writers of other shards are not held up
+                auto guards = LockShards(url_marks, hash_marks);
+                auto occupancy = occupancy_.load(std::memory_order_relaxed);
+                for (auto first = firsts.begin(); next < end; ++next, ++first) {
+                    if (!CanAddLocked(urls[next], *first, occupancy, width, hash_marks))
+                        break;
+                    std::uint64_t seq = 0;
+                    hashs[next] = DoAddUrl(urls[next], 0, seq, digests[next], true);
+                    wal_seq = std::max(wal_seq, seq);
+                }
+            }
+            // a retry or a revive may need shards not locked above, and the other
+            // modes know no hash ahead, such a url is added on its own
+            if (next < end) {
+                std::uint64_t seq = 0;
+                hashs[next] = DoAddUrl(urls[next], 0, seq, batch_md5 ? digests[next] : nullptr);
+                wal_seq = std::max(wal_seq, seq);
+                ++next;
+            }
+        }
+        EscalateIfPending();
     }
+    CommitLog(wal_seq, logged);
+    return hashs;
+}
+bool ShortUrlMgr::CanAddLocked(const std::string &url, const HashKey &first, const HashOccupancy *occupancy, int width,
+        const std::vector<char> &hash_marks) const {
+    // the width is only changed under all shard locks, it is the one first was made with
+    if (occupancy->Width() != width)
+        return false;
+    auto &url_shard = GetUrlShard(url);
+    auto info = FindRecord(url_shard.url2recs_, url);
+    if (info == nullptr && backuping_)
+        info = FindRecord(url_shard.extra_url2recs_, url);
+    if (info != nullptr)
+        return !(backuping_ || info->IsExpired()) || hash_marks[HashShardIndex(info->hash_)];
+    return !first.IsSpelledHex() && IsHashFree(occupancy, first, true);
+}
+int ShortUrlMgr::GetWorkerThreads() const {
+    int threads = load_threads_;
+#ifdef USE_OPENMP
+    if (threads <= 0)
+        threads = omp_get_max_threads();
+#endif
+    return threads < 1 ? 1 : threads;
+}
+void ShortUrlMgr::EscalateIfPending() {
+    if (!escalate_pending_ && !IsOccupancyFull())
+        return;
+    auto guards = LockAllShards();
+    if (escalate_pending_.exchange(false) && EscalateHashWidth("probe budget exceeded"))
+        return;
+    if (IsOccupancyFull())
+        RebuildOccupancy(0);
+}
+std::size_t ShortUrlMgr::ReapExpired() {
+    // the records of a snapshot being built are scheduled by the build, the wheel catches up after
+    if (loading_)
+        return 0;
+    auto now = UnixSeconds();
+    std::vector<TimingWheel::Entry> due;
+    {
+        std::lock_guard<std::mutex> guard(expiry_mtx_);
+        expiry_wheel_.Advance(now, due);
+    }
+    std::size_t reaped = 0;
+    std::uint64_t wal_seq = 0;
+    for (auto &entry : due) {
+        std::uint64_t seq = 0;
+        // a hash deleted, taken again or given a later ttl meanwhile is left alone
+        reaped += DoDelHash(entry.key_, seq, now);
+        wal_seq = std::max(wal_seq, seq);
+    }
+    CommitLog(wal_seq, nullptr);
+    if (reaped > 0)
+        LOGUTIL_LOG_I() << "reaped " << reaped << " expired of " << due.size() << " due records";
+    return reaped;
+}
+std::size_t ShortUrlMgr::MergeClicks() {
+    std::vector<std::pair<HashKey, std::uint64_t>> clicks, visits;
+    click_counter_.Drain(clicks, visits);
+    if (!clicks.empty()) {
+        std::lock_guard<std::mutex> guard(hot_mtx_);
+        hot_links_.Add(UnixSeconds(), clicks);
+    }
+    // the records of a snapshot being built are not there yet. the buffers are
+    // drained anyway and what they had is kept summed per link, so a long build
+    // grows with the links clicked, not with the clicks
+    if (loading_) {
+        for (auto &click : clicks)
+            loading_clicks_[click.first] += click.second;
+        for (auto &visit : visits)
+            loading_visitors_[visit.first].Add(visit.second);
+        return 0;
+    }
+    // their series get them in this minute
+    if (!loading_clicks_.empty()) {
+        clicks.insert(clicks.end(), loading_clicks_.begin(), loading_clicks_.end());
+        std::unordered_map<HashKey, std::uint64_t, HashKeyHasher>().swap(loading_clicks_);
+    }
+    if (clicks.empty())
+        return 0;
+    // grouped by hash shard, each is locked once and shared, CompactRecord copying a record excludes it.
+    // the visits of a link are next to each other, its sketch is locked once
+    auto shard_of = [this](const std::pair<HashKey, std::uint64_t> &click) { return HashKeyHasher()(click.first) & shard_mask_; };
+    std::sort(clicks.begin(), clicks.end(), [&shard_of](const std::pair<HashKey, std::uint64_t> &lhs,
+            const std::pair<HashKey, std::uint64_t> &rhs) {
+        return shard_of(lhs) < shard_of(rhs);
+    });
+    std::sort(visits.begin(), visits.end(), [&shard_of](const std::pair<HashKey, std::uint64_t> &lhs,
+            const std::pair<HashKey, std::uint64_t> &rhs) {
+        auto lhs_shard = shard_of(lhs), rhs_shard = shard_of(rhs);
+        return lhs_shard != rhs_shard ? lhs_shard < rhs_shard : lhs.first < rhs.first;
+    });
+    auto find = [this](HashShard &hash_shard, const HashKey &hash) {
+        ShortUrlRecord *info = nullptr;
+        if (backuping_)
+            info = FindRecord(hash_shard.extra_hash2recs_, hash);
+        return info != nullptr ? info : FindRecord(hash_shard.hash2recs_, hash);
+    };
+    auto minute = UnixSeconds() / 60;
+    std::size_t merged = 0, c = 0, v = 0;
+    for (std::size_t shard = 0; shard < hash_shards_.size(); ++shard) {
+        bool has_clicks = c < clicks.size() && shard_of(clicks[c]) == shard;
+        bool has_visits = v < visits.size() && shard_of(visits[v]) == shard;
+        if (!has_clicks && !has_visits)
+            continue;
+        auto &hash_shard = *hash_shards_[shard];
+        std::shared_lock<std::shared_mutex> guard(hash_shard.mtx_);
+        for (; c < clicks.size() && shard_of(clicks[c]) == shard; ++c) {
+            auto info = find(hash_shard, clicks[c].first);
+            if (info == nullptr)
+                continue;
+            info->clicks_.fetch_add(clicks[c].second, std::memory_order_relaxed);
+            merged += clicks[c].second;
+            if (click_series_) {
+                auto stats = MakeStats(info);
+                std::lock_guard<std::mutex> stats_guard(stats->mtx_);
+                stats->series_.Add(minute, clicks[c].second);
+            }
+        }
+        while (v < visits.size() && shard_of(visits[v]) == shard) {
+            auto &hash = visits[v].first;
+            auto end = v;
+            while (end < visits.size() && visits[end].first == hash)
+                ++end;
+            auto info = find(hash_shard, hash);
+            if (info != nullptr) {
+                auto stats = MakeStats(info);
+                std::lock_guard<std::mutex> stats_guard(stats->mtx_);
+                for (auto i = v; i < end; ++i)
+                    stats->visitors_.Add(visits[i].second);
+            }
+            v = end;
+        }
+    }
+    for (auto &sketch : loading_visitors_) {
+        auto &hash_shard = GetHashShard(sketch.first);
+        std::shared_lock<std::shared_mutex> guard(hash_shard.mtx_);
+        auto info = find(hash_shard, sketch.first);
+        if (info == nullptr)
+            continue;
+        auto stats = MakeStats(info);
+        std::lock_guard<std::mutex> stats_guard(stats->mtx_);
+        stats->visitors_.Merge(sketch.second);
+    }
+    std::unordered_map<HashKey, HyperLogLog, HashKeyHasher>().swap(loading_visitors_);
+    if (merged > 0)
+        clicks_modified_ = true;
+    return merged;
+}
+bool ShortUrlMgr::GetVisitors(const HashKey &hash, std::uint64_t &visitors) {
+    // a sketch is only read under the shard lock, see LinkStats
+    WaitLoaded();
+    auto &hash_shard = GetHashShard(hash);
+    std::shared_lock<std::shared_mutex> guard(hash_shard.mtx_);
+    auto info = FindStatsRecord(hash_shard, hash);
+    if (info == nullptr)
+        return false;
+    visitors = 0;
+    auto stats = info->stats_.load(std::memory_order_acquire);
+    if (stats != nullptr) {
+        std::lock_guard<std::mutex> stats_guard(stats->mtx_);
+        visitors = stats->visitors_.Estimate();
+    }
+    return true;
+}
+bool ShortUrlMgr::GetClickSeries(const HashKey &hash, std::int64_t &start, std::vector<std::uint64_t> &counts) {
+    WaitLoaded();
+    auto &hash_shard = GetHashShard(hash);
+    std::shared_lock<std::shared_mutex> guard(hash_shard.mtx_);
+    auto info = FindStatsRecord(hash_shard, hash);
+    if (info == nullptr)
+        return false;
+    auto minute = UnixSeconds() / 60;
+    start = (minute - ClickSeries::MINUTES + 1) * 60;
+    auto stats = info->stats_.load(std::memory_order_acquire);
+    if (stats == nullptr) {
+        counts.assign(ClickSeries::MINUTES, 0);
+        return true;
+    }
+    std::lock_guard<std::mutex> stats_guard(stats->mtx_);
+    counts = stats->series_.Counts(minute);
+    return true;
+}
+ShortUrlRecord* ShortUrlMgr::FindStatsRecord(HashShard &hash_shard, const HashKey &hash) const {
+    ShortUrlRecord *info = nullptr;
+    if (backuping_)
+        info = FindRecord(hash_shard.extra_hash2recs_, hash);
+    if (info == nullptr) {
+        info = FindRecord(hash_shard.hash2recs_, hash);
+        if (info != nullptr && backuping_ && hash_shard.extra_deleted_hashs_.Find(info) != nullptr)
+            return nullptr;
+    }
+    return info == nullptr || info->IsExpired() ? nullptr : info;
+}
+std::vector<HotLinks::Entry> ShortUrlMgr::GetTopLinks(std::int64_t window_sec, std::size_t k) {
+    std::lock_guard<std::mutex> guard(hot_mtx_);
+    return hot_links_.Top(UnixSeconds(), window_sec, k);
+}
+void ShortUrlMgr::ScheduleExpiry(const HashKey &hash, std::int64_t expire_at) {
+    if (expire_at == 0)
+        return;
+    std::lock_guard<std::mutex> guard(expiry_mtx_);
+    expiry_wheel_.Add(hash, expire_at);
+}
+void ShortUrlMgr::ReviveRecord(ShortUrlRecord *info, std::int64_t expire_at, std::uint64_t &wal_seq) {
+    info->expire_at_.store(expire_at, std::memory_order_relaxed);
+    wal_seq = LogRecord(info);
+    ScheduleExpiry(info->hash_, expire_at);
+    modified_ = true;
+}
+bool ShortUrlMgr::DelUrl(const std::string &url, bool *logged) {
+    WaitLoaded();
+    std::uint64_t wal_seq = 0;
+    auto ret = DoDelUrl(url, wal_seq);
+    CommitLog(wal_seq, logged);
+    return ret;
+}
+bool ShortUrlMgr::DelHash(const HashKey &hash, bool *logged) {
+    WaitLoaded();
+    std::uint64_t wal_seq = 0;
+    auto ret = DoDelHash(hash, wal_seq);
+    CommitLog(wal_seq, logged);
+    return ret;
+}
+
+// Do* log while holding the shard locks, so the log keeps the memory order,
+// and leave the commit wait to the caller after unlocking
+std::string ShortUrlMgr::DoAddUrl(const std::string &url, std::int64_t expire_at, std::uint64_t &wal_seq,
+        const unsigned char *digest, bool locked) {
+    auto &url_shard = GetUrlShard(url);
+    std::unique_lock<std::shared_mutex> url_guard(url_shard.mtx_, std::defer_lock);
+    if (!locked)
+        url_guard.lock();
+    auto info = FindRecord(url_shard.url2recs_, url);
+    if (info == nullptr && backuping_)
+        info = FindRecord(url_shard.extra_url2recs_, url);
+    if (info != nullptr) {
+        // deleted while frozen or run out, the record comes back with the ttl of this add
+        if (backuping_ || info->IsExpired()) {
+            auto &hash_shard = GetHashShard(info->hash_);
+            std::unique_lock<std::shared_mutex> hash_guard(hash_shard.mtx_, std::defer_lock);
+            if (!locked)
+                hash_guard.lock();
+            if (backuping_ && hash_shard.extra_deleted_hashs_.Erase(info)) {
+                hash_shard.index_.Insert(info);
+                ReviveRecord(info, expire_at, wal_seq);
+            } else if (info->IsExpired()) {
+                ReviveRecord(info, expire_at, wal_seq);
+            }
+        }
+        // the add that made it may have failed to commit, the retry logs it again and waits for the write
+        if (wal_seq == 0 && wal_ != nullptr && wal_->Unwritten())
+            wal_seq = LogRecord(info);
+        return info->hash_.ToString();
+    }
+    std::uint32_t probes = 0;
+    while (info == nullptr) {
+        std::uint32_t rounds = 0;
+        auto hash = hash_mode_ == HASH_MODE_SEQUENCE ? NextSequenceHash(url, rounds, locked) :
+            DoGenerateHash(url, &rounds, 0, digest, locked);
+        probes += rounds;
+        auto &hash_shard = GetHashShard(hash);
+        std::unique_lock<std::shared_mutex> hash_guard(hash_shard.mtx_, std::defer_lock);
+        if (!locked)
+            hash_guard.lock();
+        // another url may take the hash between generating and locking
+        if (FindRecord(hash_shard.hash2recs_, hash) != nullptr ||
+                (backuping_ && FindRecord(hash_shard.extra_hash2recs_, hash) != nullptr))
+            continue;
+        info = CreateRecord(url, hash, expire_at);
+        if (backuping_)
+            hash_shard.extra_hash2recs_.Insert(info);
+        else
+            hash_shard.hash2recs_.Insert(info);
+        hash_shard.index_.Insert(info);
+        occupancy_.load(std::memory_order_relaxed)->Add(hash);
+        wal_seq = LogRecord(info);
+        ScheduleExpiry(hash, expire_at);
+    }
+    CountProbes(probes);
+    if (backuping_)
+        url_shard.extra_url2recs_.Insert(info);
+    else
+        url_shard.url2recs_.Insert(info);
     modified_ = true;
+    auto hash = info->hash_.ToString();
     LOGUTIL_LOG_I() << "add " << hash << " = " << url;
     return hash;
 }
-bool ShortUrlMgr::DelUrl(const std::string &url) {
-    std::unique_lock<std::shared_mutex> guard(mtx_);
-    auto info_it = url2recs_.find(url);
-    if (info_it != url2recs_.end()) {
-        auto info = info_it->second;
+bool ShortUrlMgr::DoDelUrl(const std::string &url, std::uint64_t &wal_seq) {
+    auto &url_shard = GetUrlShard(url);
+    std::unique_lock<std::shared_mutex> url_guard(url_shard.mtx_);
+    auto info = FindRecord(url_shard.url2recs_, url);
+    if (info != nullptr) {
+        auto &hash_shard = GetHashShard(info->hash_);
+        std::unique_lock<std::shared_mutex> hash_guard(hash_shard.mtx_);
+        hash_shard.index_.Erase(info->hash_);
+        wal_seq = LogTombstone(info->hash_);
         if (backuping_) {
-            if (extra_deleted_hashs_.count(info->hash_) <= 0)
-                extra_deleted_hashs_.insert(info->hash_);
+            hash_shard.extra_deleted_hashs_.Insert(info);
             modified_ = true;
-            LOGUTIL_LOG_I() << "del url " << info->url_;
+            LOGUTIL_LOG_I() << "del url " << url;
             return true;
         }
-        hash2recs_.erase(info->hash_);
-        url2recs_.erase(info->url_);
+        hash_shard.hash2recs_.Erase(info);
+        url_shard.url2recs_.Erase(info);
+        occupancy_.load(std::memory_order_relaxed)->Remove(info->hash_);
+        Rcu::Retire(info, ShortUrlRecord::Destroy);
         modified_ = true;
-        LOGUTIL_LOG_I() << "del url " << info->url_;
+        LOGUTIL_LOG_I() << "del url " << url;
         return true;
     }
     if (backuping_) {
-        auto extra_it = extra_url2recs_.find(url);
-        if (extra_it != extra_url2recs_.end()) {
-            auto info = extra_it->second;
-            extra_hash2recs_.erase(info->hash_);
-            extra_url2recs_.erase(info->url_);
+        info = FindRecord(url_shard.extra_url2recs_, url);
+        if (info != nullptr) {
+            auto &hash_shard = GetHashShard(info->hash_);
+            std::unique_lock<std::shared_mutex> hash_guard(hash_shard.mtx_);
+            hash_shard.index_.Erase(info->hash_);
+            wal_seq = LogTombstone(info->hash_);
+            hash_shard.extra_hash2recs_.Erase(info);
+            url_shard.extra_url2recs_.Erase(info);
+            occupancy_.load(std::memory_order_relaxed)->Remove(info->hash_);
+            Rcu::Retire(info, ShortUrlRecord::Destroy);
             modified_ = true;
-            LOGUTIL_LOG_I() << "del url " << info->url_;
+            LOGUTIL_LOG_I() << "del url " << url;
             return true;
         }
     }
     return false;
 }
-bool ShortUrlMgr::DelHash(const std::string &hash) {
-    std::unique_lock<std::shared_mutex> guard(mtx_);
-    auto info_it = hash2recs_.find(hash);
-    if (info_it != hash2recs_.end()) {
-        if (backuping_) {
-            if (extra_deleted_hashs_.count(hash) <= 0)
-                extra_deleted_hashs_.insert(hash);
-            modified_ = true;
-            LOGUTIL_LOG_I() << "del hash " << hash;
-            return true;
+bool ShortUrlMgr::DoDelHash(const HashKey &hash, std::uint64_t &wal_seq, std::int64_t expired_by) {
+    auto &hash_shard = GetHashShard(hash);
+    while (true) {
+        // find the url first, url shard must be locked before hash shard
+        std::string url;
+        {
+            std::shared_lock<std::shared_mutex> guard(hash_shard.mtx_);
+            auto info = FindRecord(hash_shard.hash2recs_, hash);
+            if (info == nullptr && backuping_)
+                info = FindRecord(hash_shard.extra_hash2recs_, hash);
+            if (info == nullptr)
+                return false;
+            url = info->url_;
         }
-        auto url = info_it->second->url_;
-        hash2recs_.erase(hash);
-        url2recs_.erase(url);
-        modified_ = true;
-        LOGUTIL_LOG_I() << "del hash " << hash;
-        return true;
-    }
-    if (backuping_) {
-        auto extra_it = extra_hash2recs_.find(hash);
-        if (extra_it != extra_hash2recs_.end()) {
-            auto url = extra_it->second->url_;
-            extra_hash2recs_.erase(hash);
-            extra_url2recs_.erase(url);
+        auto &url_shard = GetUrlShard(url);
+        std::unique_lock<std::shared_mutex> url_guard(url_shard.mtx_);
+        std::unique_lock<std::shared_mutex> hash_guard(hash_shard.mtx_);
+        auto info = FindRecord(hash_shard.hash2recs_, hash);
+        if (info != nullptr) {
+            // hash was deleted and taken by another url while unlocked
+            if (info->url_ != url)
+                continue;
+            if (expired_by != 0 && (!info->IsExpired(expired_by) || hash_shard.extra_deleted_hashs_.Find(info) != nullptr))
+                return false;
+            hash_shard.index_.Erase(hash);
+            wal_seq = LogTombstone(hash);
+            if (backuping_) {
+                hash_shard.extra_deleted_hashs_.Insert(info);
+                modified_ = true;
+                LOGUTIL_LOG_I() << "del hash " << hash.ToString();
+                return true;
+            }
+            hash_shard.hash2recs_.Erase(info);
+            EraseUrlRecord(url_shard.url2recs_, info);
+            occupancy_.load(std::memory_order_relaxed)->Remove(hash);
+            Rcu::Retire(info, ShortUrlRecord::Destroy);
             modified_ = true;
-            LOGUTIL_LOG_I() << "del hash " << hash;
+            LOGUTIL_LOG_I() << "del hash " << hash.ToString();
             return true;
         }
+        if (backuping_) {
+            info = FindRecord(hash_shard.extra_hash2recs_, hash);
+            if (info != nullptr) {
+                if (info->url_ != url)
+                    continue;
+                if (expired_by != 0 && !info->IsExpired(expired_by))
+                    return false;
+                hash_shard.index_.Erase(hash);
+                wal_seq = LogTombstone(hash);
+                hash_shard.extra_hash2recs_.Erase(info);
+                EraseUrlRecord(url_shard.extra_url2recs_, info);
+                occupancy_.load(std::memory_order_relaxed)->Remove(hash);
+                Rcu::Retire(info, ShortUrlRecord::Destroy);
+                modified_ = true;
+                LOGUTIL_LOG_I() << "del hash " << hash.ToString();
+                return true;
+            }
+        }
+        return false;
     }
-    return false;
 }
-ShortUrlRecord ShortUrlMgr::GetUrlInfo(const std::string &key, bool is_hash) {
-    std::shared_lock<std::shared_mutex> guard(mtx_);
-    auto &key2recs = is_hash ? hash2recs_ : url2recs_;
-    auto &extra_key2recs = is_hash ? extra_hash2recs_ : extra_url2recs_;
-    auto info_it = key2recs.find(key);
-    if (info_it != key2recs.end()) {
-        auto &info = info_it->second;
-        if (backuping_ && extra_deleted_hashs_.count(info->hash_) > 0)
-            return ShortUrlRecord("", "", 0);
-        return *info;
+ShortUrlInfo ShortUrlMgr::GetUrlInfo(const HashKey &hash) {
+    Rcu::ReadGuard guard;
+    auto lazy = lazy_snapshot_.load(std::memory_order_acquire);
+    auto info = GetHashShard(hash).index_.Find(hash);
+    if (info != nullptr && info->IsExpired())
+        return ShortUrlInfo{ 0, "", HashKey() };
+    if (info != nullptr)
+        return ShortUrlInfo{ info->expire_at_, std::string(info->url_), info->hash_, info->clicks_ };
+    SnapshotRecord rec;
+    if (FindSnapshotRecord(lazy, hash, rec))
+        return ShortUrlInfo{ rec.expire_at_, std::string(rec.url_), rec.hash_, rec.clicks_ };
+    return ShortUrlInfo{ 0, "", HashKey() };
+}
+ShortUrlInfo ShortUrlMgr::GetUrlInfo(const std::string &url) {
+    WaitLoaded();
+    auto &url_shard = GetUrlShard(url);
+    std::shared_lock<std::shared_mutex> guard(url_shard.mtx_);
+    auto info = FindRecord(url_shard.url2recs_, url);
+    if (info != nullptr) {
+        if (backuping_) {
+            auto &hash_shard = GetHashShard(info->hash_);
+            std::shared_lock<std::shared_mutex> hash_guard(hash_shard.mtx_);
+            if (hash_shard.extra_deleted_hashs_.Find(info) != nullptr)
+                return ShortUrlInfo{ 0, "", HashKey() };
+        }
+        if (info->IsExpired())
+            return ShortUrlInfo{ 0, "", HashKey() };
+        return ShortUrlInfo{ info->expire_at_, url, info->hash_, info->clicks_ };
     }
     if (backuping_) {
-        auto extra_it = extra_key2recs.find(key);
-        if (extra_it != extra_key2recs.end())
-            return *extra_it->second;
+        info = FindRecord(url_shard.extra_url2recs_, url);
+        if (info != nullptr && !info->IsExpired())
+            return ShortUrlInfo{ info->expire_at_, url, info->hash_, info->clicks_ };
+    }
+    return ShortUrlInfo{ 0, "", HashKey() };
+}
+std::string ShortUrlMgr::GetUrl(const HashKey &hash) {
+    Rcu::ReadGuard guard;
+    // loaded first, a record missed in the index is still in the snapshot then
+    auto lazy = lazy_snapshot_.load(std::memory_order_acquire);
+    auto info = GetHashShard(hash).index_.Find(hash);
+    if (info != nullptr)
+        return info->IsExpired() ? "" : std::string(info->url_);
+    SnapshotRecord rec;
+    return FindSnapshotRecord(lazy, hash, rec) ? std::string(rec.url_) : "";
+}
+std::vector<std::string> ShortUrlMgr::GetUrls(const std::vector<HashKey> &hashs) {
+    std::vector<std::string> urls(hashs.size());
+    Rcu::ReadGuard guard;
+    auto lazy = lazy_snapshot_.load(std::memory_order_acquire);
+    auto num = hashs.size();
+    auto now = UnixSeconds();
+    auto prefetch_slots = [&](std::size_t begin) {
+        for (auto i = begin; i < std::min(begin + GET_BATCH_GROUP, num); ++i)
+            GetHashShard(hashs[i]).index_.PrefetchSlot(hashs[i]);
+    };
+    auto prefetch_records = [&](std::size_t begin) {
+        for (auto i = begin; i < std::min(begin + GET_BATCH_GROUP, num); ++i)
+            GetHashShard(hashs[i]).index_.PrefetchRecord(hashs[i]);
+    };
+    prefetch_slots(0);
+    prefetch_slots(GET_BATCH_GROUP);
+    prefetch_records(0);
+    for (std::size_t begin = 0; begin < num; begin += GET_BATCH_GROUP) {
+        prefetch_slots(begin + GET_BATCH_GROUP * 2);
+        prefetch_records(begin + GET_BATCH_GROUP);
+        auto end = std::min(begin + GET_BATCH_GROUP, num);
+        const ShortUrlRecord *infos[GET_BATCH_GROUP];
+        // the whole group found before any url is copied, so the url bytes load together
+        for (auto i = begin; i < end; ++i) {
+            infos[i - begin] = GetHashShard(hashs[i]).index_.Find(hashs[i]);
+            if (infos[i - begin] != nullptr)
+                __builtin_prefetch(infos[i - begin]->url_.data());
+        }
+        for (auto i = begin; i < end; ++i) {
+            SnapshotRecord rec;
+            // a record that ran out is a miss, the snapshot behind it is older
+            if (infos[i - begin] != nullptr) {
+                if (!infos[i - begin]->IsExpired(now))
+                    urls[i] = infos[i - begin]->url_;
+            } else if (FindSnapshotRecord(lazy, hashs[i], rec))
+                urls[i] = rec.url_;
+        }
     }
-    return ShortUrlRecord("", "", 0);
+    return urls;
 }
-std::string ShortUrlMgr::GetUrl(const std::string &hash) {
-    auto info = GetUrlInfo(hash, true);
-    return info.url_;
+bool ShortUrlMgr::FindSnapshotRecord(const LazySnapshot *lazy, const HashKey &hash, SnapshotRecord &rec) const {
+    return lazy != nullptr && !lazy->IsDropped(hash) && lazy->file_->Find(hash, rec) &&
+        (rec.expire_at_ == 0 || rec.expire_at_ > UnixSeconds());
 }
 std::string ShortUrlMgr::GetHash(const std::string &url) {
-    auto info = GetUrlInfo(url, false);
-    return info.hash_;
-}
-std::string ShortUrlMgr::GenerateHash(const std::string &url) const {
-    auto tmp_url = url;
-    std::string ret;
-    do {
-        md5::MD5 hash(tmp_url);
-        ret = hash.toString().substr(0, hash_width_);
-        tmp_url += ' ';
-    } while (hash2recs_.count(ret) > 0 || (backuping_ && extra_hash2recs_.count(ret) > 0));
+    auto info = GetUrlInfo(url);
+    return info.hash_.Empty() ? "" : info.hash_.ToString();
+}
+HashKey ShortUrlMgr::GenerateHash(const std::string &url, std::uint32_t *probes, int width) const {
+    return DoGenerateHash(url, probes, width, nullptr, false);
+}
+HashKey ShortUrlMgr::DoGenerateHash(const std::string &url, std::uint32_t *probes, int width, const unsigned char *digest,
+        bool locked) const {
+    HashKey ret;
+    Rcu::ReadGuard rcu_guard;
+    // the index and hash_width_ change together, take the width from the index
+    auto occupancy = occupancy_.load(std::memory_order_acquire);
+    if (width <= 0)
+        width = occupancy->Width();
+    std::uint32_t rounds = 0;
+    if (url_hash_func_ == URL_HASH_WYHASH) {
+        // the round is the seed, no copy of the url
+        unsigned char digest[16];
+        while (true) {
+            WyHash128(url.data(), url.size(), rounds, digest);
+            ret = HashKey::FromDigest(digest, width, occupancy->Alphabet());
+            ++rounds;
+            if (!ret.IsSpelledHex() && IsHashFree(occupancy, ret, locked))
+                break;
+        }
+    } else {
+        auto tmp_url = url;
+        while (true) {
+            if (rounds == 0 && digest != nullptr) {
+                ret = HashKey::FromDigest(digest, width, occupancy->Alphabet());
+            } else {
+                md5::MD5 hash(tmp_url);
+                ret = HashKey::FromDigest(hash.digest(), width, occupancy->Alphabet());
+            }
+            tmp_url += ' ';
+            ++rounds;
+            if (!ret.IsSpelledHex() && IsHashFree(occupancy, ret, locked))
+                break;
+        }
+    }
+    if (probes != nullptr)
+        *probes = rounds;
     return ret;
 }
 
-void ShortUrlMgr::SaveRecordsSync(const std::string &save_path) {
+bool ShortUrlMgr::IsHashFree(const HashOccupancy *occupancy, const HashKey &hash, bool locked) const {
+    // other widths and alphabets are not in the index
+    if (occupancy->IsTracked(hash)) {
+        if (!occupancy->MayContain(hash))
+            return true;
+        if (occupancy->IsExact())
+            return false;
+    }
+    auto &hash_shard = GetHashShard(hash);
+    std::shared_lock<std::shared_mutex> guard(hash_shard.mtx_, std::defer_lock);
+    if (!locked)
+        guard.lock();
+    return FindRecord(hash_shard.hash2recs_, hash) == nullptr &&
+        !(backuping_ && FindRecord(hash_shard.extra_hash2recs_, hash) != nullptr);
+}
+
+bool ShortUrlMgr::CompactRecord(const HashKey &hash) {
+    auto &hash_shard = GetHashShard(hash);
+    std::string url;
+    {
+        std::shared_lock<std::shared_mutex> guard(hash_shard.mtx_);
+        auto info = FindRecord(hash_shard.hash2recs_, hash);
+        if (info == nullptr)
+            return false;
+        url = info->url_;
+    }
+    auto &url_shard = GetUrlShard(url);
+    std::unique_lock<std::shared_mutex> url_guard(url_shard.mtx_);
+    std::unique_lock<std::shared_mutex> hash_guard(hash_shard.mtx_);
+    auto info = FindRecord(hash_shard.hash2recs_, hash);
+    if (info == nullptr || info->url_ != url || backuping_)
+        return false;
+    auto new_info = CreateRecord(info->url_, info->hash_, info->expire_at_);
+    new_info->clicks_.store(info->clicks_, std::memory_order_relaxed);
+    new_info->stats_.store(info->stats_.exchange(nullptr, std::memory_order_relaxed), std::memory_order_release);
+    hash_shard.hash2recs_.Erase(info);
+    hash_shard.hash2recs_.Insert(new_info);
+    url_shard.url2recs_.Erase(info);
+    url_shard.url2recs_.Insert(new_info);
+    hash_shard.index_.Insert(new_info);
+    Rcu::Retire(info, ShortUrlRecord::Destroy);
+    return true;
+}
+
+void ShortUrlMgr::CompactRecords() {
+    if (backuping_ || loading_)
+        return;
+    std::size_t reserved = 0, live = 0;
+    for (auto &arena : arenas_) {
+        arena->slab_.BeginCompact(4);
+        arena->url_bytes_.BeginCompact(2);
+    }
+    std::size_t moved = 0;
+    for (auto &hash_shard : hash_shards_) {
+        std::vector<HashKey> hashs;
+        {
+            std::shared_lock<std::shared_mutex> guard(hash_shard->mtx_);
+            for (auto info : hash_shard->hash2recs_) {
+                if (SlabAllocator::IsDraining(info) || BumpArena::IsSparse(info->url_.data()))
+                    hashs.emplace_back(info->hash_);
+            }
+        }
+        // one record per lock, writers only wait for a single copy
+        for (auto &hash : hashs)
+            moved += CompactRecord(hash);
+    }
+    for (auto &arena : arenas_) {
+        reserved += arena->slab_.PageCount() * SlabAllocator::PAGE_SIZE + arena->url_bytes_.ReservedBytes();
+        live += arena->slab_.UsedSlots() * sizeof(ShortUrlRecord) + arena->url_bytes_.LiveBytes();
+    }
+    LOGUTIL_LOG_I() << "compact moved " << moved << " records, arena reserved " << reserved << " live " << live;
+}
+
+// urls.snap replaces the old snapshot only once it is on disk, a text
+// urls.txt it was migrated from goes with it unless keep_txt. logs nothing
+bool ShortUrlMgr::CommitSnapshot(const std::string &save_path, bool keep_txt, SaveStatus &status) {
+    auto tmp_path = save_path + "/urls.snap.tmp";
+    if (std::rename(tmp_path.c_str(), (save_path + "/urls.snap").c_str()) != 0) {
+        status = { SaveStatus::RENAME_SNAPSHOT, errno };
+        return false;
+    }
+    auto fd = ::open(save_path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd >= 0) {
+        ::fsync(fd);
+        ::close(fd);
+    }
+    auto txt_path = save_path + "/urls.txt";
+    if (!keep_txt && ::unlink(txt_path.c_str()) != 0 && errno != ENOENT)
+        status = { SaveStatus::REMOVE_TXT, errno };
+    return true;
+}
+
+bool ShortUrlMgr::OpenWal(const std::string &save_path, WalFsyncPolicy policy, std::int64_t interval_ms) {
+    wal_.reset(new WriteAheadLog(save_path, policy, interval_ms));
+    return !wal_->Failed();
+}
+
+bool ShortUrlMgr::WriteSnapshot(const std::string &save_path, std::uint64_t sequence) {
+    SaveStatus status = { SaveStatus::OK, 0 };
+    auto ok = WriteSnapshotQuiet(save_path, sequence, status);
+    LogSaveStatus(save_path, status);
+    return ok;
+}
+
+void ShortUrlMgr::LogSaveStatus(const std::string &save_path, const SaveStatus &status) {
+    switch (status.step_) {
+    case SaveStatus::WRITE_SNAPSHOT:
+        LOGUTIL_LOG_E() << "write snapshot " << save_path << "/urls.snap.tmp failed: " << std::strerror(status.err_);
+        break;
+    case SaveStatus::RENAME_SNAPSHOT:
+        LOGUTIL_LOG_E() << "rename " << save_path << "/urls.snap.tmp failed: " << std::strerror(status.err_);
+        break;
+    case SaveStatus::REMOVE_TXT:
+        LOGUTIL_LOG_W() << "remove " << save_path << "/urls.txt failed: " << std::strerror(status.err_);
+        break;
+    case SaveStatus::WRITE_SERIES:
+        LOGUTIL_LOG_E() << "write series " << save_path << "/urls.series failed: " << std::strerror(status.err_);
+        break;
+    default:
+        break;
+    }
+}
+
+// caller keeps hash2recs_ unchanged
+bool ShortUrlMgr::WriteSnapshotQuiet(const std::string &save_path, std::uint64_t sequence, SaveStatus &status) {
+    std::size_t count = 0;
+    for (auto &hash_shard : hash_shards_)
+        count += hash_shard->hash2recs_.Size();
+    std::vector<SnapshotRecord> records;
+    std::deque<std::string> sketches;
+    std::vector<std::pair<HashKey, std::string>> series;
+    records.reserve(count);
+    for (auto &hash_shard : hash_shards_) {
+        for (auto info : hash_shard->hash2recs_) {
+            records.emplace_back(SnapshotRecord{ info->hash_, info->expire_at_, info->url_, info->clicks_, std::string_view() });
+            CopyVisitors(info, sketches, records.back());
+            auto stats = info->stats_.load(std::memory_order_acquire);
+            if (!click_series_ || stats == nullptr)
+                continue;
+            std::lock_guard<std::mutex> guard(stats->mtx_);
+            if (stats->series_.Empty())
+                continue;
+            series.emplace_back(info->hash_, std::string());
+            stats->series_.Serialize(series.back().second);
+        }
+    }
+    auto err = SnapshotFile::WriteQuiet(save_path + "/urls.snap.tmp", records, sequence);
+    if (err != 0) {
+        status = { SaveStatus::WRITE_SNAPSHOT, err };
+        return false;
+    }
+    if (!CommitSnapshot(save_path, keep_txt_, status))
+        return false;
+    // the series are only for the dashboards, the snapshot stands without them
+    if (click_series_ && (err = ClickSeries::WriteFileQuiet(save_path + "/urls.series", series)) != 0)
+        status = { SaveStatus::WRITE_SERIES, err };
+    return true;
+}
+
+bool ShortUrlMgr::SaveRecordsSync(const std::string &save_path) {
     if (!sn::FileUtil::IsFolderExist(save_path))
         sn::FileUtil::CreateFolder(save_path);
-    std::unique_lock<std::shared_mutex> guard(mtx_);
-    std::ofstream fout(save_path + "/urls.txt");
-    for (auto &info_pair : hash2recs_) {
-        auto &info = info_pair.second;
-        fout << info->timestamp_ << " " << info->hash_ << "\n" << info->url_ << "\n";
+    WaitLoaded();
+    std::lock_guard<std::mutex> save_guard(save_mtx_);
+    // every writer needs an unique hash shard lock, readers can go on
+    std::vector<std::shared_lock<std::shared_mutex>> guards;
+    for (auto &hash_shard : hash_shards_)
+        guards.emplace_back(hash_shard->mtx_);
+    // the async save owns the segments until it merged back
+    if (backuping_) {
+        LOGUTIL_LOG_W() << "skip sync save while async saving or exporting";
+        return false;
     }
-    fout.close();
+    // log appends need the unique lock too, so the snapshot covers exactly the closed segments
+    std::uint64_t sequence = 0;
+    auto wal_segment = RotateWal(sequence);
+    // a failed snapshot keeps the log it would have replaced
+    if (!WriteSnapshot(save_path, sequence))
+        return false;
+    if (wal_ != nullptr)
+        wal_->RemoveSegments(wal_segment);
     modified_ = false;
+    clicks_modified_ = false;
     LOGUTIL_LOG_I() << "sync save finished.";
+    return true;
 }
 void ShortUrlMgr::SaveRecordsAsync(const std::string &save_path) {
     if (!sn::FileUtil::IsFolderExist(save_path))
         sn::FileUtil::CreateFolder(save_path);
+    WaitLoaded();
+    std::uint64_t wal_segment = 0, sequence = 0;
     {
-        std::unique_lock<std::shared_mutex> guard(mtx_);
+        auto guards = LockAllShards();
+        if (backuping_) {
+            LOGUTIL_LOG_W() << "skip async save while async saving or exporting";
+            return;
+        }
+        // hash2recs_ is frozen from here, changes go to the extra sets and the next log segment
+        BeginFreeze();
+        modified_ = false;
+        clicks_modified_ = false;
+        wal_segment = RotateWal(sequence);
+    }
+    std::thread thr([this, save_path, wal_segment, sequence]() {
+        std::lock_guard<std::mutex> save_guard(save_mtx_);
+        if (WriteSnapshot(save_path, sequence)) {
+            if (wal_ != nullptr)
+                wal_->RemoveSegments(wal_segment);
+        } else {
+            modified_ = true;
+            clicks_modified_ = true;
+        }
+        EndFreeze();
+        LOGUTIL_LOG_I() << "async save finished.";
+    });
+    thr.detach();
+}
+
+void ShortUrlMgr::BeginFreeze() {
+    if (freeze_refs_++ == 0)
         backuping_ = true;
+}
+void ShortUrlMgr::EndFreeze() {
+    auto guards = LockAllShards();
+    if (--freeze_refs_ > 0)
+        return;
+    for (auto &hash_shard : hash_shards_) {
+        for (auto info : hash_shard->extra_deleted_hashs_) {
+            EraseUrlRecord(GetUrlShard(info->url_).url2recs_, info);
+            hash_shard->hash2recs_.Erase(info);
+            occupancy_.load(std::memory_order_relaxed)->Remove(info->hash_);
+            Rcu::Retire(info, ShortUrlRecord::Destroy);
+        }
+        hash_shard->hash2recs_.Insert(hash_shard->extra_hash2recs_.begin(), hash_shard->extra_hash2recs_.end());
+        hash_shard->extra_hash2recs_.Clear();
+        hash_shard->extra_deleted_hashs_.Clear();
+    }
+    for (auto &url_shard : url_shards_) {
+        url_shard->url2recs_.Insert(url_shard->extra_url2recs_.begin(), url_shard->extra_url2recs_.end());
+        url_shard->extra_url2recs_.Clear();
+    }
+    backuping_ = false;
+}
+
+std::unique_ptr<RecordExport> ShortUrlMgr::ExportRecords() {
+    WaitLoaded();
+    auto guards = LockAllShards();
+    // joins an async save already running, the records are the same then
+    BeginFreeze();
+    std::size_t count = 0;
+    for (auto &hash_shard : hash_shards_)
+        count += hash_shard->hash2recs_.Size();
+    LOGUTIL_LOG_I() << "export of " << count << " records started";
+    return std::unique_ptr<RecordExport>(new RecordExport(this, count,
+        sequence_leased_.load(std::memory_order_relaxed)));
+}
+
+RecordStream ShortUrlMgr::StreamRecords() {
+    WaitLoaded();
+    return RecordStream(this);
+}
+
+bool ShortUrlMgr::ExportSnapshot(std::ifstream &in) {
+    // not in data_path_, a crash before the unlink leaves the file where the system cleans up
+    auto tmp_dir = std::getenv("TMPDIR");
+    auto path = std::string(tmp_dir != nullptr && *tmp_dir != '\0' ? tmp_dir : "/tmp") + "/short-url-export.XXXXXX";
+    auto fd = ::mkstemp(&path[0]);
+    if (fd < 0) {
+        LOGUTIL_LOG_E() << "create " << path << " failed: " << std::strerror(errno);
+        return false;
+    }
+    ::close(fd);
+    bool ok = false;
+    {
+        // the freeze ends with the local write, not with the client
+        auto exp = ExportRecords();
+        std::vector<const ShortUrlRecord*> infos;
+        infos.reserve(exp->Size());
+        while (exp->Next(exp->Size(), infos))
+            ;
+        std::sort(infos.begin(), infos.end(), [](const ShortUrlRecord *lhs, const ShortUrlRecord *rhs) {
+            return lhs->hash_ < rhs->hash_;
+        });
+        std::string sketch;
+        ok = SnapshotFile::WriteSorted(path, infos.size(), exp->Sequence(),
+            [&infos, &sketch](std::size_t i, SnapshotRecord &rec) {
+                auto info = infos[i];
+                rec = SnapshotRecord{ info->hash_, info->expire_at_, info->url_, info->clicks_, std::string_view() };
+                sketch.clear();
+                if (SerializeVisitors(info, sketch))
+                    rec.visitors_ = sketch;
+            });
+    }
+    if (ok)
+        in.open(path, std::ios::binary);
+    // an open file stays readable, nothing is left behind once it is closed
+    ::unlink(path.c_str());
+    return ok && in.is_open();
+}
+
+RecordExport::RecordExport(ShortUrlMgr *mgr, std::size_t count, std::uint64_t sequence) : mgr_(mgr), count_(count),
+    sequence_(sequence), shard_(0), it_(mgr->hash_shards_.front()->hash2recs_.begin()) {}
+
+RecordExport::~RecordExport() {
+    mgr_->EndFreeze();
+    LOGUTIL_LOG_I() << "export of " << count_ << " records finished";
+}
+
+bool RecordExport::Next(std::size_t max, std::vector<const ShortUrlRecord*> &out) {
+    // hash2recs_ does not change while it is frozen, so neither does the
+    // iterator and no shard lock is needed to read it
+    auto &shards = mgr_->hash_shards_;
+    std::size_t given = 0;
+    while (given < max && shard_ < shards.size()) {
+        if (it_ == shards[shard_]->hash2recs_.end()) {
+            if (++shard_ < shards.size())
+                it_ = shards[shard_]->hash2recs_.begin();
+            continue;
+        }
+        out.push_back(*it_);
+        ++it_;
+        ++given;
+    }
+    return given > 0;
+}
+
+bool RecordStream::Next(std::size_t max, std::vector<ShortUrlInfo> &out) {
+    auto &shards = mgr_->hash_shards_;
+    while (pos_ == hashs_.size()) {
+        if (shard_ == shards.size())
+            return false;
+        hashs_.clear();
+        pos_ = 0;
+        // the hashs only, the records may be freed once the lock is gone
+        auto &hash_shard = *shards[shard_++];
+        std::shared_lock<std::shared_mutex> guard(hash_shard.mtx_);
+        hashs_.reserve(hash_shard.hash2recs_.Size() + hash_shard.extra_hash2recs_.Size());
+        for (auto info : hash_shard.hash2recs_)
+            hashs_.push_back(info->hash_);
+        for (auto info : hash_shard.extra_hash2recs_)
+            hashs_.push_back(info->hash_);
+    }
+    // index_ drops deleted records at once, also while frozen
+    auto &index = shards[shard_ - 1]->index_;
+    Rcu::ReadGuard guard;
+    for (auto end = std::min(pos_ + max, hashs_.size()); pos_ < end; ++pos_) {
+        auto info = index.Find(hashs_[pos_]);
+        if (info != nullptr && !info->IsExpired())
+            out.emplace_back(ShortUrlInfo{ info->expire_at_, std::string(info->url_), info->hash_, info->clicks_ });
+    }
+    return true;
+}
+
+// pages the process holds alone, in a forked child these are the pages copied on
+// write by either side plus what the child allocated itself. raw reads only,
+// the child may not touch locks other threads of the parent held at fork
+static std::uint64_t ReadPrivateDirtyKb() {
+    static const char KEY[] = "Private_Dirty:";
+    auto fd = ::open("/proc/self/smaps_rollup", O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        fd = ::open("/proc/self/smaps", O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return 0;
+    char buf[4096];
+    std::size_t size = 0;
+    std::uint64_t kb = 0;
+    while (true) {
+        auto ret = ::read(fd, buf + size, sizeof(buf) - 1 - size);
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret <= 0)
+            break;
+        size += ret;
+        buf[size] = '\0';
+        // whole lines only, the rest waits for the next read
+        char *line = buf;
+        for (char *end; (end = std::strchr(line, '\n')) != nullptr; line = end + 1) {
+            if (std::strncmp(line, KEY, sizeof(KEY) - 1) == 0)
+                kb += std::strtoull(line + sizeof(KEY) - 1, nullptr, 10);
+        }
+        size = buf + size - line;
+        // a line longer than the buffer is dropped
+        if (size == sizeof(buf) - 1)
+            size = 0;
+        std::memmove(buf, line, size);
+    }
+    ::close(fd);
+    return kb;
+}
+
+void ShortUrlMgr::SaveRecordsFork(const std::string &save_path) {
+    if (!sn::FileUtil::IsFolderExist(save_path))
+        sn::FileUtil::CreateFolder(save_path);
+    if (fork_saving_.exchange(true)) {
+        LOGUTIL_LOG_W() << "skip fork save while fork saving";
+        return;
     }
     std::thread thr([this, save_path]() {
-        std::ofstream fout(save_path + "/urls.txt");
-        for (auto &info_pair : hash2recs_) {
-            auto &info = info_pair.second;
-            fout << info->timestamp_ << " " << info->hash_ << "\n" << info->url_ << "\n";
-        }
-        std::unordered_map<std::string, std::shared_ptr<ShortUrlRecord>> add_hash2infos;
-        std::unordered_set<std::string> rm_hashs;
-        do {
-            for (auto &info_pair : add_hash2infos) {
-                auto &info = info_pair.second;
-                fout << info->timestamp_ << " " << info->hash_ << "\n" << info->url_ << "\n";
-            }
-            for (auto &hash : rm_hashs) {
-                fout << 0 << " " << "----" << "\n" << hash << "\n";
-            }
-            add_hash2infos.clear();
-            rm_hashs.clear();
-            {
-                std::unique_lock<std::shared_mutex> guard(mtx_);
-                for (auto &hash : extra_deleted_hashs_) {
-                    auto info_it = hash2recs_.find(hash);
-                    if (info_it == hash2recs_.end())
-                        continue;
-                    auto info = info_it->second;
-                    url2recs_.erase(info->url_);
-                    hash2recs_.erase(info->hash_);
-                }
-                url2recs_.insert(extra_url2recs_.begin(), extra_url2recs_.end());
-                hash2recs_.insert(extra_hash2recs_.begin(), extra_hash2recs_.end());
-
-                extra_url2recs_.clear();
-                std::swap(add_hash2infos, extra_hash2recs_);
-                std::swap(rm_hashs, extra_deleted_hashs_);
-                if (add_hash2infos.empty() && rm_hashs.empty()) {
-                    backuping_ = false;
-                    break;
-                }
+        WaitLoaded();
+        std::lock_guard<std::mutex> save_guard(save_mtx_);
+        // the child reports whether it committed and its private dirty kB
+        int fds[2];
+        if (::pipe2(fds, O_CLOEXEC) != 0) {
+            LOGUTIL_LOG_E() << "pipe for fork save failed: " << std::strerror(errno);
+            fork_saving_ = false;
+            return;
+        }
+        std::uint64_t wal_segment = 0, sequence = 0;
+        std::int64_t fork_us = 0;
+        auto start_time = std::chrono::steady_clock::now();
+        pid_t pid;
+        {
+            // the child gets a consistent heap that covers exactly the closed segments
+            auto guards = LockAllShards();
+            if (backuping_) {
+                LOGUTIL_LOG_W() << "skip fork save while async saving or exporting";
+                ::close(fds[0]);
+                ::close(fds[1]);
+                fork_saving_ = false;
+                return;
             }
-        } while (!add_hash2infos.empty() || !rm_hashs.empty());
-        modified_ = false;
-        LOGUTIL_LOG_I() << "async save finished.";
+            wal_segment = RotateWal(sequence);
+            modified_ = false;
+            clicks_modified_ = false;
+            auto fork_time = std::chrono::steady_clock::now();
+            pid = ::fork();
+            if (pid == 0) {
+                // only this thread goes on in the child, it reads the shards without
+                // locking. a lock another thread held at fork stays held here, the
+                // logger's too, so the child only reports and the parent logs
+                ::close(fds[0]);
+                SaveStatus status = { SaveStatus::OK, 0 };
+                std::uint64_t report[4] = { WriteSnapshotQuiet(save_path, sequence, status), 0, 0, 0 };
+                report[1] = ReadPrivateDirtyKb();
+                report[2] = status.step_;
+                report[3] = status.err_;
+                auto ret = ::write(fds[1], report, sizeof(report));
+                ::_exit(ret == sizeof(report) && report[0] ? 0 : 1);
+            }
+            fork_us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - fork_time).count();
+        }
+        ::close(fds[1]);
+        if (pid < 0) {
+            LOGUTIL_LOG_E() << "fork save failed: " << std::strerror(errno);
+            ::close(fds[0]);
+            modified_ = true;
+            clicks_modified_ = true;
+            fork_saving_ = false;
+            return;
+        }
+        LOGUTIL_LOG_I() << "fork save child " << pid << " started, fork took " << fork_us << " us";
+        std::uint64_t report[4] = { 0, 0, 0, 0 };
+        ssize_t ret;
+        while ((ret = ::read(fds[0], report, sizeof(report))) < 0 && errno == EINTR)
+            ;
+        if (ret == sizeof(report))
+            LogSaveStatus(save_path, SaveStatus{ static_cast<std::int32_t>(report[2]), static_cast<std::int32_t>(report[3]) });
+        ::close(fds[0]);
+        int status = 0;
+        while (::waitpid(pid, &status, 0) < 0 && errno == EINTR)
+            ;
+        auto cost = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start_time).count();
+        if (ret != sizeof(report) || report[0] == 0) {
+            LOGUTIL_LOG_E() << "fork save child " << pid << " failed, status " << status;
+            modified_ = true;
+            clicks_modified_ = true;
+            fork_saving_ = false;
+            return;
+        }
+        if (wal_ != nullptr)
+            wal_->RemoveSegments(wal_segment);
+        LOGUTIL_LOG_I() << "fork save finished in " << cost << " ms, fork " << fork_us << " us, cow " << report[1] << " kB";
+        fork_saving_ = false;
     });
     thr.detach();
 }
 
 void ShortUrlMgr::LoadRecords(const std::string &save_path) {
+    started_ = true;
     if (!sn::FileUtil::IsFolderExist(save_path))
         return;
-    auto file_path = save_path + "/urls.txt";
-    if (!FileUtil::IsFileExist(file_path))
+    WaitLoaded();
+    std::unique_ptr<LazySnapshot> lazy;
+    {
+        auto guards = LockAllShards();
+        auto snap_path = save_path + "/urls.snap";
+        auto txt_path = save_path + "/urls.txt";
+        if (FileUtil::IsFileExist(snap_path)) {
+            lazy.reset(new LazySnapshot());
+            lazy->file_ = SnapshotFile::Open(snap_path);
+            if (lazy->file_ == nullptr)
+                lazy.reset();
+            else if (lazy->file_->Sequence() != 0)
+                sequence_next_ = sequence_leased_ = lazy->file_->Sequence();
+        } else if (FileUtil::IsFileExist(txt_path)) {
+            // text snapshot of older versions, the next save migrates it.
+            // records it had that did not load are in it only, it stays next to the snapshot
+            auto skipped = LoadRecordFile(txt_path);
+            if (skipped > 0) {
+                LOGUTIL_LOG_E() << "skipped " << skipped << " records of " << txt_path << ", it is kept after saving";
+                keep_txt_ = true;
+            }
+            modified_ = true;
+        }
+        // changes after the last checkpoint
+        auto segments = WriteAheadLog::ListSegments(save_path);
+        for (auto &segment_path : segments)
+            LoadRecordFile(segment_path, lazy.get());
+        if (lazy != nullptr) {
+            std::sort(lazy->dropped_.begin(), lazy->dropped_.end());
+            lazy->dropped_.erase(std::unique(lazy->dropped_.begin(), lazy->dropped_.end()), lazy->dropped_.end());
+        }
+        RebuildOccupancy(lazy != nullptr ? lazy->file_->Size() : 0);
+        if (!segments.empty())
+            modified_ = true;
+        std::vector<std::pair<HashKey, std::string>> series;
+        if (click_series_)
+            ClickSeries::ReadFile(save_path + "/urls.series", series);
+        if (lazy == nullptr || lazy->file_->Size() == 0) {
+            AttachClickSeries(series);
+            EscalateByLoad();
+            ResetSequence();
+            return;
+        }
+        lazy->series_.swap(series);
+        loading_ = true;
+        lazy_snapshot_.store(lazy.release(), std::memory_order_release);
+    }
+    std::thread(&ShortUrlMgr::BuildSnapshotRecords, this).detach();
+}
+
+void ShortUrlMgr::AttachClickSeries(std::vector<std::pair<HashKey, std::string>> &series) {
+    auto minute = UnixSeconds() / 60;
+    std::size_t attached = 0;
+    for (auto &link : series) {
+        auto info = FindRecord(GetHashShard(link.first).hash2recs_, link.first);
+        ClickSeries loaded;
+        if (info == nullptr || !loaded.Deserialize(link.second))
+            continue;
+        loaded.Trim(minute);
+        if (loaded.Empty())
+            continue;
+        auto stats = MakeStats(info);
+        std::lock_guard<std::mutex> guard(stats->mtx_);
+        stats->series_ = std::move(loaded);
+        ++attached;
+    }
+    if (!series.empty())
+        LOGUTIL_LOG_I() << "attached " << attached << " of " << series.size() << " click series";
+    std::vector<std::pair<HashKey, std::string>>().swap(series);
+}
+
+void ShortUrlMgr::WaitLoaded() {
+    if (!loading_)
         return;
-    std::unique_lock<std::shared_mutex> guard(mtx_);
+    std::unique_lock<std::mutex> guard(load_mtx_);
+    load_cv_.wait(guard, [this]() { return !loading_; });
+}
+
+void ShortUrlMgr::BuildSnapshotRecords() {
+    auto start_time = std::chrono::steady_clock::now();
+    auto lazy = lazy_snapshot_.load(std::memory_order_acquire);
+    auto &file = *lazy->file_;
+    long shard_num = hash_shards_.size();
+    // a snapshot failing the check builds nothing, the server goes on with the log like after a failed Open
+    long chunk_num = file.Verify() ? (file.Size() + LOAD_CHUNK_SIZE - 1) / LOAD_CHUNK_SIZE : 0;
+    int threads = GetWorkerThreads();
+    std::size_t built = 0;
+    {
+        // only GetUrl runs meanwhile, it does not lock
+        auto guards = LockAllShards();
+        // entries are fixed width, so chunks split anywhere. a chunk only reads
+        // the sets the log replay filled and sorts what it keeps by hash shard
+        std::vector<std::vector<std::vector<std::size_t>>> picks(chunk_num, std::vector<std::vector<std::size_t>>(shard_num));
+#pragma omp parallel for schedule(dynamic) num_threads(threads)
+        for (long c = 0; c < chunk_num; ++c) {
+            auto begin = c * LOAD_CHUNK_SIZE;
+            auto end = std::min(begin + LOAD_CHUNK_SIZE, file.Size());
+            auto dropped = std::lower_bound(lazy->dropped_.begin(), lazy->dropped_.end(), file.At(begin).hash_);
+            for (auto i = begin; i < end; ++i) {
+                auto rec = file.At(i);
+                // the log replayed before is newer
+                while (dropped != lazy->dropped_.end() && *dropped < rec.hash_)
+                    ++dropped;
+                if (dropped != lazy->dropped_.end() && *dropped == rec.hash_)
+                    continue;
+                auto shard_idx = HashKeyHasher()(rec.hash_) & shard_mask_;
+                auto info = FindRecord(hash_shards_[shard_idx]->hash2recs_, rec.hash_);
+                // the same link logged again after the snapshot, only the clicks and visitors are in the snapshot
+                if (info != nullptr && info->url_ == rec.url_) {
+                    info->clicks_.fetch_add(rec.clicks_, std::memory_order_relaxed);
+                    MergeVisitors(info, rec.visitors_);
+                }
+                if (info != nullptr || FindRecord(GetUrlShard(rec.url_).url2recs_, rec.url_) != nullptr)
+                    continue;
+                picks[c][shard_idx].emplace_back(i);
+            }
+        }
+        // each hash shard and its arenas belong to one thread, the new records
+        // are handed on grouped by url shard
+        auto occupancy = occupancy_.load(std::memory_order_relaxed);
+        std::vector<std::vector<std::vector<ShortUrlRecord*>>> infos(shard_num, std::vector<std::vector<ShortUrlRecord*>>(shard_num));
+        std::vector<std::vector<TimingWheel::Entry>> expiring(shard_num);
+#pragma omp parallel for schedule(dynamic) num_threads(threads) reduction(+:built)
+        for (long s = 0; s < shard_num; ++s) {
+            auto &hash_shard = *hash_shards_[s];
+            std::size_t count = 0;
+            for (auto &chunk : picks)
+                count += chunk[s].size();
+            hash_shard.hash2recs_.Reserve(count);
+            hash_shard.index_.Reserve(count);
+            for (auto &chunk : picks) {
+                for (auto i : chunk[s]) {
+                    auto rec = file.At(i);
+                    auto info = CreateRecord(rec.url_, rec.hash_, rec.expire_at_);
+                    info->clicks_.store(rec.clicks_, std::memory_order_relaxed);
+                    MergeVisitors(info, rec.visitors_);
+                    hash_shard.hash2recs_.Insert(info);
+                    hash_shard.index_.Insert(info);
+                    occupancy->Add(info->hash_);
+                    infos[s][UrlHasher()(info->url_) & shard_mask_].emplace_back(info);
+                    if (rec.expire_at_ != 0)
+                        expiring[s].emplace_back(TimingWheel::Entry{ rec.hash_, rec.expire_at_ });
+                }
+            }
+            built += count;
+        }
+#pragma omp parallel for schedule(dynamic) num_threads(threads)
+        for (long u = 0; u < shard_num; ++u) {
+            auto &url_shard = *url_shards_[u];
+            std::size_t count = 0;
+            for (auto &shard_infos : infos)
+                count += shard_infos[u].size();
+            url_shard.url2recs_.Reserve(count);
+            for (auto &shard_infos : infos)
+                url_shard.url2recs_.Insert(shard_infos[u].begin(), shard_infos[u].end());
+        }
+        {
+            std::lock_guard<std::mutex> guard(expiry_mtx_);
+            for (auto &entries : expiring) {
+                for (auto &entry : entries)
+                    expiry_wheel_.Add(entry.key_, entry.expire_at_);
+            }
+        }
+        AttachClickSeries(lazy->series_);
+        EscalateByLoad();
+        ResetSequence();
+    }
+    {
+        std::lock_guard<std::mutex> guard(load_mtx_);
+        lazy_snapshot_.store(nullptr, std::memory_order_release);
+        loading_ = false;
+        load_cv_.notify_all();
+    }
+    // GetUrl may still search the mapped file
+    Rcu::RetireDelete(lazy);
+    auto cost = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start_time).count();
+    LOGUTIL_LOG_I() << "built " << built << " snapshot records in " << cost / 1000 << " ms, " <<
+        static_cast<std::int64_t>(built * 1e6 / (cost + 1)) << " records/s with " << threads << " threads";
+}
+
+std::size_t ShortUrlMgr::LoadRecordFile(const std::string &file_path, LazySnapshot *lazy) {
+    // later records win, a hash or url seen again replaces its old record
+    auto remove_record = [this](ShortUrlRecord *info) {
+        auto &hash_shard = GetHashShard(info->hash_);
+        EraseUrlRecord(GetUrlShard(info->url_).url2recs_, info);
+        hash_shard.index_.Erase(info->hash_);
+        hash_shard.hash2recs_.Erase(info);
+        Rcu::Retire(info, ShortUrlRecord::Destroy);
+    };
     std::ifstream fin(file_path);
     std::int64_t tm;
-    std::string hash, url;
-    while (fin >> tm >> hash) {
+    std::string hash_str, url;
+    HashKey hash;
+    std::size_t skipped = 0;
+    while (fin >> tm >> hash_str) {
         std::getline(fin, url);
-        while (url.empty())
-            std::getline(fin, url);
-        if (tm == 0 && hash == "----") {
-            auto rec_it = hash2recs_.find(url);
-            if (rec_it != hash2recs_.end()) {
-                auto info = rec_it->second;
-                url2recs_.erase(info->url_);
-                hash2recs_.erase(info->hash_);
-            }
+        while (url.empty() && std::getline(fin, url))
+            ;
+        // a log tail torn by a crash has no line end
+        if (fin.eof()) {
+            LOGUTIL_LOG_W() << "skip torn record at the end of " << file_path;
+            break;
+        }
+        if (tm == 0 && hash_str == "----") {
+            if (!HashKey::TryParse(url, hash, key_alphabet_))
+                continue;
+            if (lazy != nullptr)
+                lazy->dropped_.emplace_back(hash);
+            auto info = FindRecord(GetHashShard(hash).hash2recs_, hash);
+            if (info != nullptr)
+                remove_record(info);
             continue;
         }
-        auto info = std::make_shared<ShortUrlRecord>(url, hash, tm);
-        url2recs_[url] = info;
-        hash2recs_[hash] = info;
+        if (tm == 0 && hash_str == "++++") {
+            // a sequence lease, later numbers of its width are unused. hex if the alphabet is missing
+            int width = 0;
+            unsigned long long end = 0;
+            char name[16] = "hex";
+            KeyAlphabet alphabet;
+            if (std::sscanf(url.c_str(), "%d %llu %15s", &width, &end, name) >= 2 && ParseKeyAlphabet(name, alphabet) &&
+                    width >= 1 && width <= HashKey::MaxWidth(alphabet) && KeyPermutation::Fits(width, alphabet) &&
+                    end <= KeyPermutation::Space(width, alphabet))
+                sequence_next_ = sequence_leased_ = KeyPermutation::Pack(width, alphabet, end);
+            continue;
+        }
+        if (!HashKey::TryParse(hash_str, hash, key_alphabet_)) {
+            LOGUTIL_LOG_E() << "skip record with invalid hash " << hash_str << " = " << url;
+            ++skipped;
+            continue;
+        }
+        auto &hash_shard = GetHashShard(hash);
+        auto &url_shard = GetUrlShard(url);
+        // the log has no clicks, a link logged again keeps those it had
+        std::uint64_t clicks = 0;
+        LinkStats *stats = nullptr;
+        auto old_info = FindRecord(hash_shard.hash2recs_, hash);
+        if (old_info != nullptr) {
+            if (old_info->url_ == url) {
+                clicks = old_info->clicks_;
+                stats = old_info->stats_.exchange(nullptr);
+            }
+            remove_record(old_info);
+        }
+        old_info = FindRecord(url_shard.url2recs_, url);
+        if (old_info != nullptr)
+            remove_record(old_info);
+        auto info = CreateRecord(url, hash, tm);
+        info->clicks_.store(clicks, std::memory_order_relaxed);
+        info->stats_.store(stats, std::memory_order_relaxed);
+        url_shard.url2recs_.Insert(info);
+        hash_shard.hash2recs_.Insert(info);
+        hash_shard.index_.Insert(info);
+        ScheduleExpiry(hash, tm);
+    }
+    return skipped;
+}
+
+sn::ServerConfig sn::DefaultServerConfig(ShortUrlMgr *mgr) {
+    ServerConfig cfg;
+    cfg.log_path_ = "log/";
+    cfg.bind_ip_ = "::1";
+    cfg.max_num_ = -1;
+    cfg.port_ = 8080;
+    cfg.svr_ = nullptr;
+
+    cfg.data_path_ = "data/";
+    cfg.save_internal_ = 60;
+    cfg.click_save_internal_ = 600;
+    cfg.save_async_ = false;
+    cfg.save_fork_ = false;
+    cfg.wal_fsync_ = "interval";
+    cfg.wal_fsync_ms_ = 100;
+    cfg.key_alphabet_ = "hex";
+    cfg.hash_width_ = 6;
+    cfg.hash_width_max_ = 10;
+    // hashs stay at hash_width_ unless a budget is set, 2 is a sane one
+    cfg.hash_probe_budget_ = 0;
+    cfg.hash_mode_ = "md5";
+    cfg.hash_func_ = "md5";
+    cfg.sequence_secret_ = "";
+    cfg.shard_num_ = 16;
+    cfg.load_threads_ = 0;
+    cfg.add_batch_max_ = 1000;
+    cfg.get_batch_max_ = 1000;
+    cfg.unique_visitors_ = false;
+    cfg.click_series_ = false;
+    cfg.mgr_ = mgr;
+    return cfg;
+}
+
+void sn::ApplyKeyConfig(ShortUrlMgr &mgr, const ServerConfig &cfg) {
+    mgr.SetShardNum(cfg.shard_num_);
+    mgr.SetLoadThreads(cfg.load_threads_);
+    KeyAlphabet key_alphabet;
+    if (!ParseKeyAlphabet(cfg.key_alphabet_, key_alphabet)) {
+        LOGUTIL_LOG_W() << "unknown key_alphabet " << cfg.key_alphabet_ << ", use hex";
+        key_alphabet = KEY_ALPHABET_HEX;
+    }
+    mgr.SetKeyAlphabet(key_alphabet);
+    mgr.SetHashWidth(cfg.hash_width_);
+    mgr.SetProbeBudget(cfg.hash_probe_budget_, cfg.hash_width_max_);
+    HashMode hash_mode;
+    if (!ParseHashMode(cfg.hash_mode_, hash_mode)) {
+        LOGUTIL_LOG_W() << "unknown hash_mode " << cfg.hash_mode_ << ", use md5";
+        hash_mode = HASH_MODE_MD5;
+    }
+    mgr.SetHashMode(hash_mode, cfg.sequence_secret_);
+    UrlHashFunc hash_func;
+    if (!ParseUrlHashFunc(cfg.hash_func_, hash_func)) {
+        LOGUTIL_LOG_W() << "unknown hash_func " << cfg.hash_func_ << ", use md5";
+        hash_func = URL_HASH_MD5;
     }
+    mgr.SetUrlHashFunc(hash_func);
 }
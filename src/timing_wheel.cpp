@@ -0,0 +1,61 @@
+#include "timing_wheel.h"
+
+namespace sn {
+
+TimingWheel::TimingWheel(std::int64_t now) : now_(now), size_(0) {
+    for (int level = 0; level < LEVELS; ++level)
+        levels_[level].resize(Mask(level) + 1);
+}
+
+void TimingWheel::Add(const HashKey &key, std::int64_t expire_at) {
+    ++size_;
+    Place(Entry{ key, expire_at });
+}
+
+// an entry of level k is at most one whole round of it ahead, so it is moved
+// down the first time its slot comes up and lands on a lower level then
+void TimingWheel::Place(const Entry &entry) {
+    auto delta = entry.expire_at_ - now_;
+    if (delta <= 0) {
+        due_.push_back(entry);
+        return;
+    }
+    for (int level = 0; level < LEVELS; ++level) {
+        auto shift = Shift(level);
+        if (delta >> shift <= Mask(level)) {
+            levels_[level][(entry.expire_at_ >> shift) & Mask(level)].push_back(entry);
+            return;
+        }
+    }
+    // further out than the top level reaches, parked in its last slot to be placed again
+    auto top = LEVELS - 1;
+    levels_[top][((now_ >> Shift(top)) - 1) & Mask(top)].push_back(entry);
+}
+
+void TimingWheel::Take(std::vector<Entry> &slot, std::vector<Entry> &expired) {
+    if (slot.empty())
+        return;
+    size_ -= slot.size();
+    expired.insert(expired.end(), slot.begin(), slot.end());
+    std::vector<Entry>().swap(slot);
+}
+
+void TimingWheel::Advance(std::int64_t now, std::vector<Entry> &expired) {
+    Take(due_, expired);
+    // nothing to hand out on the way, a long pause or clock jump costs nothing
+    if (size_ == 0 && now > now_)
+        now_ = now;
+    while (now_ < now) {
+        ++now_;
+        for (int level = 1; level < LEVELS && (now_ & ((std::int64_t(1) << Shift(level)) - 1)) == 0; ++level) {
+            std::vector<Entry> slot;
+            slot.swap(levels_[level][(now_ >> Shift(level)) & Mask(level)]);
+            for (auto &entry : slot)
+                Place(entry);
+        }
+        Take(levels_[0][now_ & Mask(0)], expired);
+        Take(due_, expired);
+    }
+}
+
+} /* namespace sn */
@@ -0,0 +1,15 @@
+#include "url_hash.h"
+
+namespace sn {
+
+bool ParseUrlHashFunc(const std::string &name, UrlHashFunc &func) {
+    if (name == "md5")
+        func = URL_HASH_MD5;
+    else if (name == "wyhash")
+        func = URL_HASH_WYHASH;
+    else
+        return false;
+    return true;
+}
+
+} /* namespace sn */
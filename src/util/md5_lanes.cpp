@@ -0,0 +1,306 @@
+#include "util/md5_lanes.h"
+
+#include <cstdint>
+#include <cstring>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define MD5_LANES_X86 1
+#endif
+
+namespace md5 {
+
+#ifdef MD5_LANES_X86
+
+namespace {
+
+typedef std::uint32_t Vec4 __attribute__((vector_size(16)));
+typedef std::uint32_t Vec8 __attribute__((vector_size(32)));
+
+/* One input in a lane. Its whole blocks are read in place, the rest of it
+and the padding from tail_. */
+struct Lane {
+    const byte *data_;
+    size_t full_blocks_;
+    size_t blocks_;
+    size_t next_;
+    size_t input_;
+    byte tail_[128];
+};
+
+const byte IDLE_BLOCK[64] = { 0 };
+
+inline void StartLane(Lane &lane, const std::string_view &input, size_t index) {
+    lane.data_ = reinterpret_cast<const byte*>(input.data());
+    lane.full_blocks_ = input.size() / 64;
+    auto rest = input.size() % 64;
+    lane.blocks_ = lane.full_blocks_ + (rest < 56 ? 1 : 2);
+    lane.next_ = 0;
+    lane.input_ = index;
+    std::memset(lane.tail_, 0, sizeof(lane.tail_));
+    std::memcpy(lane.tail_, lane.data_ + lane.full_blocks_ * 64, rest);
+    lane.tail_[rest] = 0x80;
+    auto bits = static_cast<std::uint64_t>(input.size()) * 8;
+    auto end = lane.tail_ + (lane.blocks_ - lane.full_blocks_) * 64 - 8;
+    for (int i = 0; i < 8; ++i)
+        end[i] = static_cast<byte>(bits >> (i * 8));
+}
+
+inline const byte* LaneBlock(const Lane &lane) {
+    if (lane.next_ < lane.full_blocks_)
+        return lane.data_ + lane.next_ * 64;
+    return lane.tail_ + (lane.next_ - lane.full_blocks_) * 64;
+}
+
+/* The step functions of md5.cpp on whole vectors, F and G with one op less. */
+#define LANE_F(x, y, z) ((z) ^ ((x) & ((y) ^ (z))))
+#define LANE_G(x, y, z) ((y) ^ ((z) & ((x) ^ (y))))
+#define LANE_H(x, y, z) ((x) ^ (y) ^ (z))
+#define LANE_I(x, y, z) ((y) ^ ((x) | ~(z)))
+#define LANE_STEP(f, a, b, c, d, x, s, ac) { \
+    (a) += LANE_##f((b), (c), (d)) + (x) + static_cast<std::uint32_t>(ac); \
+    (a) = (((a) << (s)) | ((a) >> (32 - (s)))) + (b); \
+}
+
+template <typename V>
+__attribute__((always_inline)) inline void TransformLanes(V state[4], const V x[16]) {
+    V a = state[0], b = state[1], c = state[2], d = state[3];
+
+    LANE_STEP(F, a, b, c, d, x[0], 7, 0xd76aa478);
+    LANE_STEP(F, d, a, b, c, x[1], 12, 0xe8c7b756);
+    LANE_STEP(F, c, d, a, b, x[2], 17, 0x242070db);
+    LANE_STEP(F, b, c, d, a, x[3], 22, 0xc1bdceee);
+    LANE_STEP(F, a, b, c, d, x[4], 7, 0xf57c0faf);
+    LANE_STEP(F, d, a, b, c, x[5], 12, 0x4787c62a);
+    LANE_STEP(F, c, d, a, b, x[6], 17, 0xa8304613);
+    LANE_STEP(F, b, c, d, a, x[7], 22, 0xfd469501);
+    LANE_STEP(F, a, b, c, d, x[8], 7, 0x698098d8);
+    LANE_STEP(F, d, a, b, c, x[9], 12, 0x8b44f7af);
+    LANE_STEP(F, c, d, a, b, x[10], 17, 0xffff5bb1);
+    LANE_STEP(F, b, c, d, a, x[11], 22, 0x895cd7be);
+    LANE_STEP(F, a, b, c, d, x[12], 7, 0x6b901122);
+    LANE_STEP(F, d, a, b, c, x[13], 12, 0xfd987193);
+    LANE_STEP(F, c, d, a, b, x[14], 17, 0xa679438e);
+    LANE_STEP(F, b, c, d, a, x[15], 22, 0x49b40821);
+
+    LANE_STEP(G, a, b, c, d, x[1], 5, 0xf61e2562);
+    LANE_STEP(G, d, a, b, c, x[6], 9, 0xc040b340);
+    LANE_STEP(G, c, d, a, b, x[11], 14, 0x265e5a51);
+    LANE_STEP(G, b, c, d, a, x[0], 20, 0xe9b6c7aa);
+    LANE_STEP(G, a, b, c, d, x[5], 5, 0xd62f105d);
+    LANE_STEP(G, d, a, b, c, x[10], 9, 0x2441453);
+    LANE_STEP(G, c, d, a, b, x[15], 14, 0xd8a1e681);
+    LANE_STEP(G, b, c, d, a, x[4], 20, 0xe7d3fbc8);
+    LANE_STEP(G, a, b, c, d, x[9], 5, 0x21e1cde6);
+    LANE_STEP(G, d, a, b, c, x[14], 9, 0xc33707d6);
+    LANE_STEP(G, c, d, a, b, x[3], 14, 0xf4d50d87);
+    LANE_STEP(G, b, c, d, a, x[8], 20, 0x455a14ed);
+    LANE_STEP(G, a, b, c, d, x[13], 5, 0xa9e3e905);
+    LANE_STEP(G, d, a, b, c, x[2], 9, 0xfcefa3f8);
+    LANE_STEP(G, c, d, a, b, x[7], 14, 0x676f02d9);
+    LANE_STEP(G, b, c, d, a, x[12], 20, 0x8d2a4c8a);
+
+    LANE_STEP(H, a, b, c, d, x[5], 4, 0xfffa3942);
+    LANE_STEP(H, d, a, b, c, x[8], 11, 0x8771f681);
+    LANE_STEP(H, c, d, a, b, x[11], 16, 0x6d9d6122);
+    LANE_STEP(H, b, c, d, a, x[14], 23, 0xfde5380c);
+    LANE_STEP(H, a, b, c, d, x[1], 4, 0xa4beea44);
+    LANE_STEP(H, d, a, b, c, x[4], 11, 0x4bdecfa9);
+    LANE_STEP(H, c, d, a, b, x[7], 16, 0xf6bb4b60);
+    LANE_STEP(H, b, c, d, a, x[10], 23, 0xbebfbc70);
+    LANE_STEP(H, a, b, c, d, x[13], 4, 0x289b7ec6);
+    LANE_STEP(H, d, a, b, c, x[0], 11, 0xeaa127fa);
+    LANE_STEP(H, c, d, a, b, x[3], 16, 0xd4ef3085);
+    LANE_STEP(H, b, c, d, a, x[6], 23, 0x4881d05);
+    LANE_STEP(H, a, b, c, d, x[9], 4, 0xd9d4d039);
+    LANE_STEP(H, d, a, b, c, x[12], 11, 0xe6db99e5);
+    LANE_STEP(H, c, d, a, b, x[15], 16, 0x1fa27cf8);
+    LANE_STEP(H, b, c, d, a, x[2], 23, 0xc4ac5665);
+
+    LANE_STEP(I, a, b, c, d, x[0], 6, 0xf4292244);
+    LANE_STEP(I, d, a, b, c, x[7], 10, 0x432aff97);
+    LANE_STEP(I, c, d, a, b, x[14], 15, 0xab9423a7);
+    LANE_STEP(I, b, c, d, a, x[5], 21, 0xfc93a039);
+    LANE_STEP(I, a, b, c, d, x[12], 6, 0x655b59c3);
+    LANE_STEP(I, d, a, b, c, x[3], 10, 0x8f0ccc92);
+    LANE_STEP(I, c, d, a, b, x[10], 15, 0xffeff47d);
+    LANE_STEP(I, b, c, d, a, x[1], 21, 0x85845dd1);
+    LANE_STEP(I, a, b, c, d, x[8], 6, 0x6fa87e4f);
+    LANE_STEP(I, d, a, b, c, x[15], 10, 0xfe2ce6e0);
+    LANE_STEP(I, c, d, a, b, x[6], 15, 0xa3014314);
+    LANE_STEP(I, b, c, d, a, x[13], 21, 0x4e0811a1);
+    LANE_STEP(I, a, b, c, d, x[4], 6, 0xf7537e82);
+    LANE_STEP(I, d, a, b, c, x[11], 10, 0xbd3af235);
+    LANE_STEP(I, c, d, a, b, x[2], 15, 0x2ad7d2bb);
+    LANE_STEP(I, b, c, d, a, x[9], 21, 0xeb86d391);
+
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+}
+
+#undef LANE_F
+#undef LANE_G
+#undef LANE_H
+#undef LANE_I
+#undef LANE_STEP
+
+/* Word j of every lane's block into x[j], the usual unpack transpose. */
+__attribute__((always_inline)) inline void LoadBlocks(const byte *const blocks[4], Vec4 x[16]) {
+    for (int c = 0; c < 4; ++c) {
+        Vec4 r[4];
+        for (int i = 0; i < 4; ++i)
+            std::memcpy(&r[i], blocks[i] + c * 16, 16);
+        Vec4 t0 = __builtin_shuffle(r[0], r[1], Vec4{ 0, 4, 1, 5 });
+        Vec4 t1 = __builtin_shuffle(r[0], r[1], Vec4{ 2, 6, 3, 7 });
+        Vec4 t2 = __builtin_shuffle(r[2], r[3], Vec4{ 0, 4, 1, 5 });
+        Vec4 t3 = __builtin_shuffle(r[2], r[3], Vec4{ 2, 6, 3, 7 });
+        x[c * 4] = __builtin_shuffle(t0, t2, Vec4{ 0, 1, 4, 5 });
+        x[c * 4 + 1] = __builtin_shuffle(t0, t2, Vec4{ 2, 3, 6, 7 });
+        x[c * 4 + 2] = __builtin_shuffle(t1, t3, Vec4{ 0, 1, 4, 5 });
+        x[c * 4 + 3] = __builtin_shuffle(t1, t3, Vec4{ 2, 3, 6, 7 });
+    }
+}
+
+/* The unpacks stay within 128 bit halves, the last step swaps the halves. */
+__attribute__((always_inline)) inline void LoadBlocks(const byte *const blocks[8], Vec8 x[16]) {
+    for (int c = 0; c < 2; ++c) {
+        Vec8 r[8], t[8], u[8];
+        for (int i = 0; i < 8; ++i)
+            std::memcpy(&r[i], blocks[i] + c * 32, 32);
+        for (int i = 0; i < 8; i += 2) {
+            t[i] = __builtin_shuffle(r[i], r[i + 1], Vec8{ 0, 8, 1, 9, 4, 12, 5, 13 });
+            t[i + 1] = __builtin_shuffle(r[i], r[i + 1], Vec8{ 2, 10, 3, 11, 6, 14, 7, 15 });
+        }
+        for (int i = 0; i < 8; i += 4) {
+            u[i] = __builtin_shuffle(t[i], t[i + 2], Vec8{ 0, 1, 8, 9, 4, 5, 12, 13 });
+            u[i + 1] = __builtin_shuffle(t[i], t[i + 2], Vec8{ 2, 3, 10, 11, 6, 7, 14, 15 });
+            u[i + 2] = __builtin_shuffle(t[i + 1], t[i + 3], Vec8{ 0, 1, 8, 9, 4, 5, 12, 13 });
+            u[i + 3] = __builtin_shuffle(t[i + 1], t[i + 3], Vec8{ 2, 3, 10, 11, 6, 7, 14, 15 });
+        }
+        for (int j = 0; j < 4; ++j) {
+            x[c * 8 + j] = __builtin_shuffle(u[j], u[j + 4], Vec8{ 0, 1, 2, 3, 8, 9, 10, 11 });
+            x[c * 8 + j + 4] = __builtin_shuffle(u[j], u[j + 4], Vec8{ 4, 5, 6, 7, 12, 13, 14, 15 });
+        }
+    }
+}
+
+/* Lanes pick up the next input as soon as theirs is done, so inputs of
+different lengths keep all lanes busy until the batch runs dry. */
+template <typename V, int LANES>
+__attribute__((always_inline)) inline void DigestLanes(const std::string_view *inputs, size_t num, byte (*digests)[16]) {
+    static const std::uint32_t INIT[4] = { 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476 };
+    Lane lanes[LANES];
+    V state[4];
+    for (int j = 0; j < 4; ++j)
+        state[j] = V{} + INIT[j];
+    size_t next_input = 0;
+    int busy = 0;
+    for (int i = 0; i < LANES; ++i) {
+        if (next_input < num) {
+            StartLane(lanes[i], inputs[next_input], next_input);
+            ++next_input;
+            ++busy;
+        } else {
+            lanes[i].input_ = num;
+        }
+    }
+    while (busy > 0) {
+        const byte *blocks[LANES];
+        for (int i = 0; i < LANES; ++i)
+            blocks[i] = lanes[i].input_ < num ? LaneBlock(lanes[i]) : IDLE_BLOCK;
+        V x[16];
+        LoadBlocks(blocks, x);
+        TransformLanes(state, x);
+        alignas(32) std::uint32_t done[LANES];
+        alignas(32) std::uint32_t words[4][LANES];
+        bool any_done = false;
+        for (int i = 0; i < LANES; ++i) {
+            auto &lane = lanes[i];
+            done[i] = lane.input_ < num && ++lane.next_ == lane.blocks_ ? ~0u : 0;
+            any_done |= done[i] != 0;
+        }
+        if (!any_done)
+            continue;
+        std::memcpy(words, state, sizeof(words));
+        for (int i = 0; i < LANES; ++i) {
+            if (done[i] == 0)
+                continue;
+            auto &lane = lanes[i];
+            for (int j = 0; j < 4; ++j)
+                std::memcpy(digests[lane.input_] + j * 4, &words[j][i], 4);
+            if (next_input < num) {
+                StartLane(lane, inputs[next_input], next_input);
+                ++next_input;
+            } else {
+                lane.input_ = num;
+                --busy;
+            }
+        }
+        // the done lanes start over from the initial state
+        V mask;
+        std::memcpy(&mask, done, sizeof(mask));
+        for (int j = 0; j < 4; ++j)
+            state[j] = (state[j] & ~mask) | (INIT[j] & mask);
+    }
+}
+
+void DigestSse2(const std::string_view *inputs, size_t num, byte (*digests)[16]) {
+    DigestLanes<Vec4, 4>(inputs, num, digests);
+}
+
+__attribute__((target("avx2"))) void DigestAvx2(const std::string_view *inputs, size_t num, byte (*digests)[16]) {
+    DigestLanes<Vec8, 8>(inputs, num, digests);
+}
+
+} /* namespace */
+
+#endif // MD5_LANES_X86
+
+static void DigestScalar(const std::string_view *inputs, size_t num, byte (*digests)[16]) {
+    for (size_t i = 0; i < num; ++i) {
+        MD5 hash(inputs[i].data(), inputs[i].size());
+        std::memcpy(digests[i], hash.digest(), 16);
+    }
+}
+
+LaneIsa DetectLaneIsa() {
+#ifdef MD5_LANES_X86
+    static const LaneIsa isa = __builtin_cpu_supports("avx2") ? LANE_ISA_AVX2 : LANE_ISA_SSE2;
+    return isa;
+#else
+    return LANE_ISA_SCALAR;
+#endif
+}
+
+const char* LaneIsaName(LaneIsa isa) {
+    switch (isa) {
+    case LANE_ISA_SSE2:
+        return "sse2";
+    case LANE_ISA_AVX2:
+        return "avx2";
+    default:
+        return "scalar";
+    }
+}
+
+void DigestBatch(const std::string_view *inputs, size_t num, byte (*digests)[16]) {
+    DigestBatch(inputs, num, digests, DetectLaneIsa());
+}
+
+void DigestBatch(const std::string_view *inputs, size_t num, byte (*digests)[16], LaneIsa isa) {
+    if (isa > DetectLaneIsa())
+        isa = DetectLaneIsa();
+    // a lone input gains nothing from the lanes
+    if (num < 2)
+        isa = LANE_ISA_SCALAR;
+#ifdef MD5_LANES_X86
+    if (isa == LANE_ISA_AVX2)
+        return DigestAvx2(inputs, num, digests);
+    if (isa == LANE_ISA_SSE2)
+        return DigestSse2(inputs, num, digests);
+#endif
+    DigestScalar(inputs, num, digests);
+}
+
+} /* namespace md5 */
@@ -0,0 +1,254 @@
+#include "wal.h"
+#include "util/FileUtil.h"
+#include "util/LoggerUtil.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace sn {
+
+static const std::string SEGMENT_PREFIX = "urls.wal.";
+
+static bool ParseSegmentId(const std::string &filename, std::uint64_t &id) {
+    if (filename.compare(0, SEGMENT_PREFIX.size(), SEGMENT_PREFIX) != 0 || filename.size() == SEGMENT_PREFIX.size())
+        return false;
+    auto digits = filename.substr(SEGMENT_PREFIX.size());
+    if (digits.find_first_not_of("0123456789") != std::string::npos)
+        return false;
+    id = std::strtoull(digits.c_str(), nullptr, 10);
+    return true;
+}
+
+static std::vector<std::uint64_t> ListSegmentIds(const std::string &folder) {
+    std::vector<std::uint64_t> ids;
+    std::uint64_t id;
+    for (auto &filename : FileUtil::ListFolderFiles(folder, true, false).first) {
+        if (ParseSegmentId(filename, id))
+            ids.emplace_back(id);
+    }
+    std::sort(ids.begin(), ids.end());
+    return ids;
+}
+
+bool ParseWalFsyncPolicy(const std::string &name, WalFsyncPolicy &policy) {
+    if (name == "always")
+        policy = WAL_FSYNC_ALWAYS;
+    else if (name == "interval")
+        policy = WAL_FSYNC_INTERVAL;
+    else if (name == "never")
+        policy = WAL_FSYNC_NEVER;
+    else
+        return false;
+    return true;
+}
+
+WriteAheadLog::WriteAheadLog(const std::string &folder, WalFsyncPolicy policy, std::int64_t interval_ms) :
+    folder_(folder), policy_(policy), interval_ms_(interval_ms < 1 ? 1 : interval_ms), fd_(-1), segment_id_(0),
+    segment_size_(0), append_seq_(0), written_seq_(0), writing_(false), syncing_(false), dirty_(false), failed_(false), stop_(false) {
+    if (!FileUtil::IsFolderExist(folder_))
+        FileUtil::CreateFolder(folder_);
+    // never append to an old segment, its tail may be torn
+    auto ids = ListSegmentIds(folder_);
+    failed_ = !OpenSegment(ids.empty() ? 1 : ids.back() + 1);
+    if (policy_ == WAL_FSYNC_INTERVAL)
+        sync_thr_ = std::thread(&WriteAheadLog::SyncLoop, this);
+}
+
+WriteAheadLog::~WriteAheadLog() {
+    {
+        std::unique_lock<std::mutex> guard(mtx_);
+        stop_ = true;
+        sync_cv_.notify_all();
+        cv_.wait(guard, [this]() { return !writing_ && !syncing_; });
+        WriteBuffer(fd_, buf_);
+        buf_.clear();
+        if (fd_ >= 0) {
+            if (policy_ != WAL_FSYNC_NEVER)
+                ::fdatasync(fd_);
+            ::close(fd_);
+            fd_ = -1;
+        }
+    }
+    if (sync_thr_.joinable())
+        sync_thr_.join();
+}
+
+std::string WriteAheadLog::SegmentPath(std::uint64_t id) const {
+    return folder_ + "/" + SEGMENT_PREFIX + std::to_string(id);
+}
+
+bool WriteAheadLog::OpenSegment(std::uint64_t id) {
+    auto path = SegmentPath(id);
+    fd_ = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    segment_id_ = id;
+    segment_size_ = 0;
+    if (fd_ < 0) {
+        LOGUTIL_LOG_E() << "open wal " << path << " failed: " << std::strerror(errno);
+        return false;
+    }
+    return true;
+}
+
+bool WriteAheadLog::WriteBuffer(int fd, const std::string &buf) {
+    if (buf.empty())
+        return true;
+    if (fd < 0)
+        return false;
+    std::size_t done = 0;
+    while (done < buf.size()) {
+        auto ret = ::write(fd, buf.data() + done, buf.size() - done);
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
+            LOGUTIL_LOG_E() << "write wal failed: " << std::strerror(errno);
+            return false;
+        }
+        done += ret;
+    }
+    return true;
+}
+
+std::uint64_t WriteAheadLog::Append(const std::string &entry) {
+    std::lock_guard<std::mutex> guard(mtx_);
+    buf_ += entry;
+    return ++append_seq_;
+}
+
+bool WriteAheadLog::Commit(std::uint64_t seq) {
+    std::unique_lock<std::mutex> guard(mtx_);
+    bool repaired = false;
+    while (written_seq_ < seq) {
+        // the segment is not touched while the sync thread holds it
+        if (writing_ || (failed_ && syncing_)) {
+            cv_.wait(guard);
+            continue;
+        }
+        // one more try per commit, a dead disk fails them without piling up segments
+        if (failed_) {
+            if (repaired || !Repair())
+                return false;
+            repaired = true;
+        }
+        // become the leader, everything appended so far goes in one write
+        writing_ = true;
+        std::string buf;
+        buf.swap(buf_);
+        auto upto = append_seq_;
+        auto fd = fd_;
+        guard.unlock();
+        bool ok = WriteBuffer(fd, buf);
+        if (ok && policy_ == WAL_FSYNC_ALWAYS && ::fdatasync(fd) != 0) {
+            LOGUTIL_LOG_E() << "sync wal failed: " << std::strerror(errno);
+            ok = false;
+        }
+        guard.lock();
+        if (ok) {
+            written_seq_ = upto;
+            segment_size_ += buf.size();
+            dirty_ = true;
+        } else {
+            // kept in order ahead of what was appended meanwhile, never dropped
+            buf_.insert(0, buf);
+            failed_ = true;
+        }
+        writing_ = false;
+        cv_.notify_all();
+    }
+    return true;
+}
+
+bool WriteAheadLog::Failed() {
+    std::lock_guard<std::mutex> guard(mtx_);
+    return failed_;
+}
+
+bool WriteAheadLog::Unwritten() {
+    std::lock_guard<std::mutex> guard(mtx_);
+    return written_seq_ < append_seq_;
+}
+
+// a torn record would end the replay of its segment, so it goes before anything follows it
+bool WriteAheadLog::Repair() {
+    if (fd_ >= 0 && ::ftruncate(fd_, segment_size_) == 0) {
+        failed_ = false;
+        return true;
+    }
+    if (fd_ >= 0) {
+        LOGUTIL_LOG_W() << "truncate wal " << SegmentPath(segment_id_) << " failed: " << std::strerror(errno);
+        ::close(fd_);
+    }
+    failed_ = !OpenSegment(segment_id_ + 1);
+    return !failed_;
+}
+
+std::uint64_t WriteAheadLog::Rotate() {
+    std::unique_lock<std::mutex> guard(mtx_);
+    cv_.wait(guard, [this]() { return !writing_ && !syncing_; });
+    auto old_id = segment_id_;
+    // the tail stays in buf_ until a segment has it on disk
+    auto flush = [this]() {
+        if (!WriteBuffer(fd_, buf_))
+            return false;
+        if (fd_ >= 0 && policy_ != WAL_FSYNC_NEVER && ::fdatasync(fd_) != 0) {
+            LOGUTIL_LOG_E() << "sync wal failed: " << std::strerror(errno);
+            return false;
+        }
+        segment_size_ += buf_.size();
+        buf_.clear();
+        written_seq_ = append_seq_;
+        return true;
+    };
+    bool ok = flush();
+    if (fd_ >= 0)
+        ::close(fd_);
+    // what the old segment missed before is in memory, the checkpoint the rotation is
+    // for covers it. a tail it failed to take leads the new segment, replaying it over
+    // the checkpoint changes nothing
+    failed_ = !OpenSegment(old_id + 1) || (!ok && !flush());
+    dirty_ = false;
+    cv_.notify_all();
+    return old_id;
+}
+
+void WriteAheadLog::RemoveSegments(std::uint64_t last_id) {
+    for (auto id : ListSegmentIds(folder_)) {
+        if (id <= last_id && ::unlink(SegmentPath(id).c_str()) != 0)
+            LOGUTIL_LOG_W() << "remove wal " << SegmentPath(id) << " failed: " << std::strerror(errno);
+    }
+}
+
+std::vector<std::string> WriteAheadLog::ListSegments(const std::string &folder) {
+    std::vector<std::string> ret;
+    for (auto id : ListSegmentIds(folder))
+        ret.emplace_back(folder + "/" + SEGMENT_PREFIX + std::to_string(id));
+    return ret;
+}
+
+void WriteAheadLog::SyncLoop() {
+    std::unique_lock<std::mutex> guard(mtx_);
+    while (!stop_) {
+        sync_cv_.wait_for(guard, std::chrono::milliseconds(interval_ms_), [this]() { return stop_; });
+        if (stop_ || !dirty_)
+            continue;
+        syncing_ = true;
+        dirty_ = false;
+        auto fd = fd_;
+        guard.unlock();
+        bool ok = fd >= 0 && ::fdatasync(fd) == 0;
+        if (!ok)
+            LOGUTIL_LOG_E() << "sync wal failed: " << std::strerror(errno);
+        guard.lock();
+        // commits since the last sync already answered, the next one repairs the segment
+        if (!ok)
+            failed_ = true;
+        syncing_ = false;
+        cv_.notify_all();
+    }
+}
+
+} /* namespace sn */
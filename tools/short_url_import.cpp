@@ -0,0 +1,263 @@
+// builds a data directory the server loads from a list of urls, offline
+//   short_url_import [options] <input|-> <data_path>
+// the server must not run on data_path meanwhile. urls already in data_path
+// keep their hashs, the new ones get the hashs the server would give them
+// adding the input in order
+
+#include "task.h"
+#include "util/ConfigUtil.h"
+#include "util/FileUtil.h"
+#include "util/LoggerUtil.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace sn;
+
+// rows handed to AddUrls at once, the input is never held longer than that
+static constexpr std::size_t IMPORT_CHUNK_ROWS = 65536;
+
+enum ImportFormat {
+    IMPORT_FORMAT_AUTO = 0,
+    IMPORT_FORMAT_LINES,    /* one url per line */
+    IMPORT_FORMAT_CSV,
+    IMPORT_FORMAT_TSV,
+};
+
+struct ImportOptions {
+    ImportFormat format_ = IMPORT_FORMAT_AUTO;
+    int column_ = 1;
+    bool header_ = false;
+    std::string config_ = "short-url-server.ini";
+    int threads_ = -1;
+    bool verbose_ = false;
+    std::string input_;
+    std::string data_path_;
+};
+
+static bool ParseImportFormat(const std::string &name, ImportFormat &format) {
+    if (name == "auto")
+        format = IMPORT_FORMAT_AUTO;
+    else if (name == "lines")
+        format = IMPORT_FORMAT_LINES;
+    else if (name == "csv")
+        format = IMPORT_FORMAT_CSV;
+    else if (name == "tsv")
+        format = IMPORT_FORMAT_TSV;
+    else
+        return false;
+    return true;
+}
+
+static bool EndsWith(const std::string &str, const std::string &suffix) {
+    return str.size() >= suffix.size() && str.compare(str.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+static void Usage(const char *name) {
+    std::fprintf(stderr,
+        "usage: %s [options] <input|-> <data_path>\n"
+        "  --format=auto|lines|csv|tsv  auto picks by the extension of input, lines otherwise\n"
+        "  --column=N                   1-based column of the url in csv and tsv, default 1\n"
+        "  --header                     skip the first row\n"
+        "  --config=FILE                key options like the server reads them, default short-url-server.ini\n"
+        "  --threads=N                  digest threads, 0 for all cores, default load_threads of the config\n"
+        "  --verbose                    log to stderr too\n", name);
+}
+
+static bool ParseOptions(int argc, char *argv[], ImportOptions &opts) {
+    std::vector<std::string> positional;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        auto value = [&arg](const char *prefix) { return arg.substr(std::string(prefix).size()); };
+        if (arg.rfind("--format=", 0) == 0) {
+            if (!ParseImportFormat(value("--format="), opts.format_))
+                return false;
+        } else if (arg.rfind("--column=", 0) == 0) {
+            opts.column_ = std::atoi(value("--column=").c_str());
+            if (opts.column_ < 1)
+                return false;
+        } else if (arg == "--header") {
+            opts.header_ = true;
+        } else if (arg.rfind("--config=", 0) == 0) {
+            opts.config_ = value("--config=");
+        } else if (arg.rfind("--threads=", 0) == 0) {
+            opts.threads_ = std::atoi(value("--threads=").c_str());
+        } else if (arg == "--verbose") {
+            opts.verbose_ = true;
+        } else if (arg.size() > 1 && arg[0] == '-') {
+            return false;
+        } else {
+            positional.push_back(arg);
+        }
+    }
+    if (positional.size() != 2 || positional[1].empty())
+        return false;
+    opts.input_ = positional[0];
+    opts.data_path_ = positional[1];
+    if (opts.format_ == IMPORT_FORMAT_AUTO) {
+        if (EndsWith(opts.input_, ".csv"))
+            opts.format_ = IMPORT_FORMAT_CSV;
+        else if (EndsWith(opts.input_, ".tsv"))
+            opts.format_ = IMPORT_FORMAT_TSV;
+        else
+            opts.format_ = IMPORT_FORMAT_LINES;
+    }
+    return true;
+}
+
+// column of a csv or tsv row, a quoted csv field may hold the separator and "" for a quote
+static bool ExtractColumn(const std::string &row, char sep, bool quoting, int column, std::string &field) {
+    std::size_t pos = 0;
+    for (int col = 1; ; ++col) {
+        field.clear();
+        if (quoting && pos < row.size() && row[pos] == '"') {
+            ++pos;
+            while (pos < row.size()) {
+                if (row[pos] == '"') {
+                    if (pos + 1 < row.size() && row[pos + 1] == '"') {
+                        field += '"';
+                        pos += 2;
+                        continue;
+                    }
+                    ++pos;
+                    break;
+                }
+                field += row[pos++];
+            }
+            auto next = row.find(sep, pos);
+            pos = next == std::string::npos ? row.size() : next;
+        } else {
+            auto next = row.find(sep, pos);
+            auto end = next == std::string::npos ? row.size() : next;
+            field.assign(row, pos, end - pos);
+            pos = end;
+        }
+        if (col == column)
+            return true;
+        if (pos >= row.size())
+            return false;
+        ++pos;
+    }
+}
+
+static void ReadKeyConfig(const std::string &config, ServerConfig &cfg) {
+    if (!FileUtil::IsFileExist(config)) {
+        LOGUTIL_LOG_I() << "no " << config << ", use the default key options";
+        return;
+    }
+    auto cfg_map = ConfigUtil::ConfigMap(config);
+    cfg_map.TryReadConfig(cfg.key_alphabet_, "key_alphabet");
+    cfg_map.TryReadConfig(cfg.hash_width_, "hash_width");
+    cfg_map.TryReadConfig(cfg.hash_width_max_, "hash_width_max");
+    cfg_map.TryReadConfig(cfg.hash_probe_budget_, "hash_probe_budget");
+    cfg_map.TryReadConfig(cfg.hash_mode_, "hash_mode");
+    cfg_map.TryReadConfig(cfg.hash_func_, "hash_func");
+    cfg_map.TryReadConfig(cfg.sequence_secret_, "sequence_secret");
+    cfg_map.TryReadConfig(cfg.shard_num_, "shard_num");
+    cfg_map.TryReadConfig(cfg.load_threads_, "load_threads");
+}
+
+int main(int argc, char *argv[])
+{
+    ImportOptions opts;
+    if (!ParseOptions(argc, argv, opts)) {
+        Usage(argv[0]);
+        return 2;
+    }
+    LoggerUtil::InitLogRotation(argv[0], "log/", opts.verbose_);
+
+    ShortUrlMgr mgr;
+    auto cfg = sn::DefaultServerConfig(&mgr);
+    ReadKeyConfig(opts.config_, cfg);
+    if (opts.threads_ >= 0)
+        cfg.load_threads_ = opts.threads_;
+    ApplyKeyConfig(mgr, cfg);
+
+    std::ifstream file;
+    if (opts.input_ != "-") {
+        file.open(opts.input_);
+        if (!file) {
+            std::fprintf(stderr, "can not open %s\n", opts.input_.c_str());
+            return 1;
+        }
+    }
+    std::istream &in = opts.input_ == "-" ? std::cin : file;
+
+    auto data_path = opts.data_path_;
+    if (data_path.back() != '/')
+        data_path += '/';
+    mgr.LoadRecords(data_path);
+    mgr.WaitLoaded();
+    auto records_before = mgr.GetRecordCount();
+
+    auto start = std::chrono::steady_clock::now();
+    auto last_report = start;
+    auto elapsed = [&start]() {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    };
+    std::size_t rows = 0, skipped = 0;
+    std::vector<std::string> urls;
+    urls.reserve(IMPORT_CHUNK_ROWS);
+    auto flush = [&]() {
+        if (urls.empty())
+            return;
+        mgr.AddUrls(urls);
+        urls.clear();
+        auto now = std::chrono::steady_clock::now();
+        if (now - last_report >= std::chrono::seconds(5)) {
+            last_report = now;
+            std::fprintf(stderr, "%zu rows, %.0f rows/s\n", rows, rows / elapsed());
+        }
+    };
+
+    char sep = opts.format_ == IMPORT_FORMAT_TSV ? '\t' : ',';
+    bool quoting = opts.format_ == IMPORT_FORMAT_CSV;
+    std::string row, url;
+    bool first = true;
+    while (std::getline(in, row)) {
+        if (!row.empty() && row.back() == '\r')
+            row.pop_back();
+        if (first && opts.header_) {
+            first = false;
+            continue;
+        }
+        first = false;
+        if (row.empty())
+            continue;
+        ++rows;
+        if (opts.format_ == IMPORT_FORMAT_LINES)
+            url = row;
+        else if (!ExtractColumn(row, sep, quoting, opts.column_, url))
+            url.clear();
+        if (url.empty()) {
+            ++skipped;
+            continue;
+        }
+        urls.push_back(std::move(url));
+        if (urls.size() >= IMPORT_CHUNK_ROWS)
+            flush();
+    }
+    flush();
+    auto added = mgr.GetRecordCount() - records_before;
+
+    // the log is only opened now so that saving drops the segments of the last server run
+    if (!mgr.OpenWal(data_path, WAL_FSYNC_NEVER, 100)) {
+        std::fprintf(stderr, "can not open the log in %s\n", data_path.c_str());
+        return 1;
+    }
+    if (!mgr.SaveRecordsSync(data_path)) {
+        std::fprintf(stderr, "can not save %s, see the log\n", data_path.c_str());
+        return 1;
+    }
+
+    auto secs = elapsed();
+    std::fprintf(stderr, "%zu rows in %.2fs, %.0f rows/s: %zu new, %zu already there, %zu without url, %zu records\n",
+        rows, secs, secs > 0 ? rows / secs : 0., added, rows - skipped - added, skipped, mgr.GetRecordCount());
+    LOGUTIL_LOG_I() << "imported " << opts.input_ << " into " << data_path << ": " << rows << " rows " << added << " new";
+    return 0;
+}